@@ -0,0 +1,825 @@
+/*
+ * Copyright (C) 2026 Michael Brown <mbrown@fensystems.co.uk>.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * @file
+ *
+ * Host-side decompression benchmark
+ *
+ * Extracts compressed chunks from WIM files and embedded bootmgr.exe
+ * images from bootmgr files, and measures the speed of each
+ * decompressor over the resulting corpus.
+ *
+ * When built with BENCH_WIMLIB, each chunk is first also decompressed
+ * using wimlib as a reference implementation, and the outputs are
+ * compared byte for byte.
+ *
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include "wimboot.h"
+#include "vdisk.h"
+#include "wim.h"
+#include "lzx.h"
+#include "xca.h"
+#include "lznt1.h"
+#include "lzms.h"
+#ifdef BENCH_WIMLIB
+#include <wimlib.h>
+#endif
+
+#define eprintf(...) fprintf ( stderr, __VA_ARGS__ )
+
+/** Minimum offset of an embedded bootmgr.exe within bootmgr */
+#define BOOTMGR_MIN_LEN 16384
+
+/** Suppress debug messages from decompressors */
+int cmdline_quiet = 1;
+
+/** A decompressor */
+struct bench_codec {
+	/** Name */
+	const char *name;
+	/** Decompress data
+	 *
+	 * @v data		Compressed data
+	 * @v len		Length of compressed data
+	 * @v buf		Decompression buffer, or NULL
+	 * @v max_len		Length of decompression buffer
+	 * @v window		Window size (i.e. WIM chunk length)
+	 * @ret out_len		Length of decompressed data, or negative error
+	 */
+	ssize_t ( * decompress ) ( const void *data, size_t len, void *buf,
+				   size_t max_len, size_t window );
+	/** Reference compression type, or zero if there is no reference */
+	int reference;
+};
+
+#ifdef BENCH_WIMLIB
+#define BENCH_REFERENCE_LZX WIMLIB_COMPRESSION_TYPE_LZX
+#define BENCH_REFERENCE_XCA WIMLIB_COMPRESSION_TYPE_XPRESS
+#define BENCH_REFERENCE_LZMS WIMLIB_COMPRESSION_TYPE_LZMS
+#else
+#define BENCH_REFERENCE_LZX 0
+#define BENCH_REFERENCE_XCA 0
+#define BENCH_REFERENCE_LZMS 0
+#endif
+
+/** Decompressors */
+enum bench_codec_index {
+	BENCH_LZX = 0,
+	BENCH_XCA,
+	BENCH_LZNT1,
+	BENCH_LZMS,
+	BENCH_CODECS
+};
+
+/**
+ * Decompress XCA-compressed data
+ *
+ * @v data		Compressed data
+ * @v len		Length of compressed data
+ * @v buf		Decompression buffer, or NULL
+ * @v max_len		Length of decompression buffer
+ * @v window		Window size (ignored)
+ * @ret out_len		Length of decompressed data, or negative error
+ */
+static ssize_t bench_xca ( const void *data, size_t len, void *buf,
+			   size_t max_len, size_t window __unused ) {
+
+	return xca_decompress ( data, len, buf, max_len );
+}
+
+/**
+ * Decompress LZNT1-compressed data
+ *
+ * @v data		Compressed data
+ * @v len		Length of compressed data
+ * @v buf		Decompression buffer, or NULL
+ * @v max_len		Length of decompression buffer
+ * @v window		Window size (ignored)
+ * @ret out_len		Length of decompressed data, or negative error
+ */
+static ssize_t bench_lznt1 ( const void *data, size_t len, void *buf,
+			     size_t max_len, size_t window __unused ) {
+
+	return lznt1_decompress ( data, len, buf, max_len );
+}
+
+/**
+ * Decompress LZMS-compressed data
+ *
+ * @v data		Compressed data
+ * @v len		Length of compressed data
+ * @v buf		Decompression buffer
+ * @v max_len		Length of decompressed data
+ * @v window		Window size (ignored)
+ * @ret out_len		Length of decompressed data, or negative error
+ */
+static ssize_t bench_lzms ( const void *data, size_t len, void *buf,
+			    size_t max_len, size_t window __unused ) {
+
+	return lzms_decompress ( data, len, buf, max_len );
+}
+
+/** Decompressors */
+static struct bench_codec bench_codecs[BENCH_CODECS] = {
+	[BENCH_LZX] = { "lzx", lzx_decompress_window, BENCH_REFERENCE_LZX },
+	[BENCH_XCA] = { "xca", bench_xca, BENCH_REFERENCE_XCA },
+	[BENCH_LZNT1] = { "lznt1", bench_lznt1, 0 },
+	[BENCH_LZMS] = { "lzms", bench_lzms, BENCH_REFERENCE_LZMS },
+};
+
+/** A compressed chunk */
+struct bench_chunk {
+	/** Decompressor */
+	struct bench_codec *codec;
+	/** Compressed data */
+	const void *data;
+	/** Length of compressed data */
+	size_t len;
+	/** Length of decompressed data */
+	size_t out_len;
+	/** Window size */
+	size_t window;
+	/** Fastest decompression time (in nanoseconds) */
+	uint64_t time;
+};
+
+/** Benchmark corpus */
+static struct bench_chunk *chunks;
+
+/** Number of chunks in corpus */
+static unsigned int count;
+
+/** Number of chunks allocated in corpus */
+static unsigned int max_count;
+
+/** Command-line options */
+struct options {
+	/** Number of times to decompress each chunk */
+	unsigned int repeat;
+};
+
+/**
+ * Allocate memory
+ *
+ * @v len		Length
+ * @ret ptr		Allocated memory
+ */
+static void * xmalloc ( size_t len ) {
+	void *ptr;
+
+	ptr = malloc ( len );
+	if ( ! ptr ) {
+		eprintf ( "Could not allocate %zd bytes\n", len );
+		exit ( 1 );
+	}
+
+	return ptr;
+}
+
+/**
+ * Get current time
+ *
+ * @ret time		Time (in nanoseconds)
+ */
+static uint64_t now ( void ) {
+	struct timespec ts;
+
+	clock_gettime ( CLOCK_MONOTONIC, &ts );
+	return ( ( ts.tv_sec * 1000000000ULL ) + ts.tv_nsec );
+}
+
+/**
+ * Add chunk to corpus
+ *
+ * @v codec		Decompressor
+ * @v data		Compressed data
+ * @v len		Length of compressed data
+ * @v out_len		Length of decompressed data
+ * @v window		Window size
+ */
+static void add_chunk ( struct bench_codec *codec, const void *data,
+			size_t len, size_t out_len, size_t window ) {
+	struct bench_chunk *chunk;
+
+	/* Grow corpus if necessary */
+	if ( count == max_count ) {
+		max_count = ( max_count ? ( 2 * max_count ) : 256 );
+		chunks = realloc ( chunks, ( max_count * sizeof ( *chunks ) ) );
+		if ( ! chunks ) {
+			eprintf ( "Could not allocate corpus\n" );
+			exit ( 1 );
+		}
+	}
+
+	/* Add chunk */
+	chunk = &chunks[count++];
+	chunk->codec = codec;
+	chunk->data = data;
+	chunk->len = len;
+	chunk->out_len = out_len;
+	chunk->window = window;
+	chunk->time = UINT64_MAX;
+}
+
+/**
+ * Map file
+ *
+ * @v name		File name
+ * @v len		Length to fill in
+ * @ret data		File data
+ */
+static const void * map_file ( const char *name, size_t *len ) {
+	struct stat stat;
+	void *data;
+	int fd;
+
+	/* Open file */
+	fd = open ( name, O_RDONLY );
+	if ( fd < 0 ) {
+		eprintf ( "Could not open %s: %s\n", name, strerror ( errno ) );
+		exit ( 1 );
+	}
+
+	/* Get file size */
+	if ( fstat ( fd, &stat ) < 0 ) {
+		eprintf ( "Could not get size of %s: %s\n",
+			  name, strerror ( errno ) );
+		exit ( 1 );
+	}
+	*len = stat.st_size;
+
+	/* Map file */
+	data = mmap ( NULL, *len, PROT_READ, MAP_SHARED, fd, 0 );
+	if ( data == MAP_FAILED ) {
+		eprintf ( "Could not map %s: %s\n", name, strerror ( errno ) );
+		exit ( 1 );
+	}
+
+	close ( fd );
+	return data;
+}
+
+/**
+ * Add chunks of WIM resource to corpus
+ *
+ * @v name		File name
+ * @v wim		WIM file data
+ * @v wim_len		Length of WIM file
+ * @v codec		Decompressor
+ * @v chunk_len		Chunk length
+ * @v resource		Resource header
+ * @v buf		Buffer for decompressed resource, or NULL
+ */
+static void add_resource ( const char *name, const void *wim, size_t wim_len,
+			   struct bench_codec *codec, size_t chunk_len,
+			   struct wim_resource_header *resource, void *buf ) {
+	const void *data = ( wim + resource->offset );
+	size_t zlen = ( resource->zlen__flags & WIM_RESHDR_ZLEN_MASK );
+	size_t len = resource->len;
+	size_t entry_len = ( ( len > 0xffffffffULL ) ? 8 : 4 );
+	unsigned int chunks_count;
+	unsigned int i;
+	size_t table_len;
+	size_t start;
+	size_t end;
+	uint64_t raw;
+	size_t out_len;
+
+	/* Sanity check */
+	if ( ( resource->offset > wim_len ) ||
+	     ( zlen > ( wim_len - resource->offset ) ) ) {
+		eprintf ( "Resource %#llx+%#zx overruns %s\n",
+			  ( ( unsigned long long ) resource->offset ), zlen,
+			  name );
+		exit ( 1 );
+	}
+
+	/* Handle uncompressed resources */
+	if ( ! ( resource->zlen__flags & WIM_RESHDR_COMPRESSED ) ) {
+		if ( buf )
+			memcpy ( buf, data, len );
+		return;
+	}
+
+	/* Process each chunk */
+	chunks_count = ( ( len + chunk_len - 1 ) / chunk_len );
+	table_len = ( ( chunks_count ? ( chunks_count - 1 ) : 0 ) * entry_len );
+	if ( table_len > zlen ) {
+		eprintf ( "Chunk table overruns resource in %s\n", name );
+		exit ( 1 );
+	}
+	for ( i = 0 ; i < chunks_count ; i++ ) {
+
+		/* Find chunk boundaries */
+		start = end = 0;
+		if ( i ) {
+			raw = 0;
+			memcpy ( &raw, ( data + ( ( i - 1 ) * entry_len ) ),
+				 entry_len );
+			start = raw;
+		}
+		if ( i < ( chunks_count - 1 ) ) {
+			raw = 0;
+			memcpy ( &raw, ( data + ( i * entry_len ) ), entry_len );
+			end = raw;
+		} else {
+			end = ( zlen - table_len );
+		}
+		if ( ( start > end ) || ( end > ( zlen - table_len ) ) ) {
+			eprintf ( "Invalid chunk %d in %s\n", i, name );
+			exit ( 1 );
+		}
+		out_len = ( ( i < ( chunks_count - 1 ) ) ? chunk_len :
+			    ( len - ( i * chunk_len ) ) );
+
+		/* Chunks that could not be compressed are stored raw */
+		if ( ( end - start ) == out_len ) {
+			if ( buf ) {
+				memcpy ( ( buf + ( i * chunk_len ) ),
+					 ( data + table_len + start ), out_len );
+			}
+			continue;
+		}
+
+		/* Add compressed chunk */
+		add_chunk ( codec, ( data + table_len + start ),
+			    ( end - start ), out_len, chunk_len );
+		if ( buf &&
+		     ( codec->decompress ( ( data + table_len + start ),
+					   ( end - start ),
+					   ( buf + ( i * chunk_len ) ),
+					   out_len, chunk_len ) !=
+		       ( ssize_t ) out_len ) ) {
+			eprintf ( "Could not decompress chunk %d in %s\n",
+				  i, name );
+			exit ( 1 );
+		}
+	}
+}
+
+/**
+ * Add chunks of WIM file to corpus
+ *
+ * @v name		File name
+ * @v wim		WIM file data
+ * @v len		Length of WIM file
+ */
+static void add_wim ( const char *name, const void *wim, size_t len ) {
+	const struct wim_header *header = wim;
+	struct wim_resource_header lookup;
+	struct wim_lookup_entry *entries;
+	struct bench_codec *codec;
+	size_t chunk_len;
+	unsigned int first = count;
+	unsigned int i;
+
+	/* Identify decompressor */
+	if ( header->flags & WIM_HDR_LZX ) {
+		codec = &bench_codecs[BENCH_LZX];
+	} else if ( header->flags & WIM_HDR_XPRESS ) {
+		codec = &bench_codecs[BENCH_XCA];
+	} else if ( header->flags & WIM_HDR_LZMS ) {
+		codec = &bench_codecs[BENCH_LZMS];
+	} else {
+		eprintf ( "Ignoring uncompressed %s\n", name );
+		return;
+	}
+	chunk_len = ( header->chunk_len ? header->chunk_len : WIM_CHUNK_LEN );
+
+	/* Read lookup table */
+	memcpy ( &lookup, &header->lookup, sizeof ( lookup ) );
+	entries = xmalloc ( lookup.len );
+	add_resource ( name, wim, len, codec, chunk_len, &lookup, entries );
+
+	/* Add each resource */
+	for ( i = 0 ; i < ( lookup.len / sizeof ( entries[0] ) ) ; i++ ) {
+		if ( entries[i].resource.zlen__flags &
+		     WIM_RESHDR_PACKED_STREAMS )
+			continue;
+		add_resource ( name, wim, len, codec, chunk_len,
+			       &entries[i].resource, NULL );
+	}
+	free ( entries );
+
+	printf ( "%s: %d %s chunks\n", name, ( count - first ), codec->name );
+}
+
+/**
+ * Check for an empty paragraph
+ *
+ * @v pgh		Paragraph
+ * @ret is_empty	Paragraph is empty
+ */
+static int is_empty_pgh ( const void *pgh ) {
+	const uint32_t *dwords = pgh;
+
+	return ( ( dwords[0] | dwords[1] | dwords[2] | dwords[3] ) == 0 );
+}
+
+/**
+ * Add embedded bootmgr.exe to corpus
+ *
+ * @v name		File name
+ * @v data		File data
+ * @v len		Length of file
+ *
+ * This uses the same signature checks as wimboot itself.
+ */
+static void add_bootmgr ( const char *name, const void *data, size_t len ) {
+	const uint8_t *compressed;
+	struct bench_codec *codec;
+	size_t offset;
+	size_t compressed_len;
+	ssize_t out_len;
+
+	/* Look for an embedded compressed bootmgr.exe */
+	for ( offset = BOOTMGR_MIN_LEN ; offset < ( len - BOOTMGR_MIN_LEN ) ;
+	      offset += 0x08 ) {
+		compressed = ( data + offset );
+		compressed_len = ( len - offset );
+		codec = NULL;
+		if ( ( ( offset & 0x0f ) == 0x00 ) &&
+		     ( ( compressed[0x02] & 0x03 ) == 0x00 ) &&
+		     ( compressed[0x03] == 'M' ) &&
+		     ( compressed[0x04] == 'Z' ) ) {
+			codec = &bench_codecs[BENCH_LZNT1];
+		}
+		if ( ( ( compressed[0x00] & 0x0f ) != 0x00 ) &&
+		     ( ( compressed[0x26] & 0xf0 ) != 0x00 ) &&
+		     ( ( compressed[0x2d] & 0x0f ) != 0x00 ) &&
+		     ( is_empty_pgh ( compressed - 0x10 ) ) &&
+		     ( ! is_empty_pgh ( ( compressed + 0x400 ) ) ) &&
+		     ( ! is_empty_pgh ( ( compressed + 0x800 ) ) ) &&
+		     ( ! is_empty_pgh ( ( compressed + 0xc00 ) ) ) ) {
+			codec = &bench_codecs[BENCH_XCA];
+		}
+		if ( ! codec )
+			continue;
+		out_len = codec->decompress ( compressed, compressed_len,
+					      NULL, 0, 0 );
+		if ( out_len < 0 )
+			continue;
+		add_chunk ( codec, compressed, compressed_len, out_len,
+			    out_len );
+		printf ( "%s: %s bootmgr.exe at +%#zx\n",
+			 name, codec->name, offset );
+		return;
+	}
+
+	eprintf ( "No WIM or embedded bootmgr.exe found in %s\n", name );
+	exit ( 1 );
+}
+
+/**
+ * Add file to corpus
+ *
+ * @v name		File name
+ */
+static void add_file ( const char *name ) {
+	const struct wim_header *header;
+	const void *data;
+	size_t len;
+
+	/* Map file */
+	data = map_file ( name, &len );
+
+	/* Add as WIM file or as bootmgr */
+	header = data;
+	if ( ( len >= sizeof ( *header ) ) &&
+	     ( memcmp ( header->signature, "MSWIM\0\0\0",
+			sizeof ( header->signature ) ) == 0 ) ) {
+		add_wim ( name, data, len );
+	} else if ( len > ( 2 * BOOTMGR_MIN_LEN ) ) {
+		add_bootmgr ( name, data, len );
+	} else {
+		eprintf ( "Unrecognised file %s\n", name );
+		exit ( 1 );
+	}
+}
+
+#ifdef BENCH_WIMLIB
+
+/**
+ * Compare decompressed output against reference implementation
+ *
+ * @ret rc		Return status code
+ */
+static int compare ( void ) {
+	struct wimlib_decompressor *decompressor;
+	struct bench_chunk *chunk;
+	unsigned int matched = 0;
+	unsigned int skipped = 0;
+	unsigned int failed = 0;
+	unsigned int i;
+	size_t max_len = 0;
+	size_t offset;
+	uint8_t *expected;
+	uint8_t *buf;
+	ssize_t out_len;
+
+	/* Allocate output buffers */
+	for ( i = 0 ; i < count ; i++ ) {
+		if ( max_len < chunks[i].out_len )
+			max_len = chunks[i].out_len;
+	}
+	expected = xmalloc ( max_len ? max_len : 1 );
+	buf = xmalloc ( max_len ? max_len : 1 );
+
+	/* Compare each chunk */
+	for ( i = 0 ; i < count ; i++ ) {
+		chunk = &chunks[i];
+
+		/* Decompress using reference implementation, if possible */
+		if ( ( ! chunk->codec->reference ) ||
+		     ( wimlib_create_decompressor ( chunk->codec->reference,
+						    chunk->window,
+						    &decompressor ) != 0 ) ) {
+			skipped++;
+			continue;
+		}
+		if ( wimlib_decompress ( chunk->data, chunk->len, expected,
+					 chunk->out_len, decompressor ) != 0 ) {
+			wimlib_free_decompressor ( decompressor );
+			eprintf ( "%s chunk %d rejected by reference\n",
+				  chunk->codec->name, i );
+			failed++;
+			continue;
+		}
+		wimlib_free_decompressor ( decompressor );
+
+		/* Decompress and compare */
+		memset ( buf, 0, chunk->out_len );
+		out_len = chunk->codec->decompress ( chunk->data, chunk->len,
+						     buf, chunk->out_len,
+						     chunk->window );
+		if ( out_len != ( ssize_t ) chunk->out_len ) {
+			eprintf ( "%s chunk %d decompressed to %zd bytes "
+				  "(expected %zd)\n", chunk->codec->name, i,
+				  out_len, chunk->out_len );
+			failed++;
+			continue;
+		}
+		for ( offset = 0 ; offset < chunk->out_len ; offset++ ) {
+			if ( buf[offset] != expected[offset] )
+				break;
+		}
+		if ( offset < chunk->out_len ) {
+			eprintf ( "%s chunk %d differs from reference at "
+				  "%#zx\n", chunk->codec->name, i, offset );
+			failed++;
+			continue;
+		}
+		matched++;
+	}
+
+	printf ( "%d chunks match reference, %d differ, %d have no "
+		 "reference\n", matched, failed, skipped );
+	free ( buf );
+	free ( expected );
+	return ( failed ? -1 : 0 );
+}
+
+#endif /* BENCH_WIMLIB */
+
+/**
+ * Compare chunk times
+ *
+ * @v first		First time
+ * @v second		Second time
+ * @ret diff		Difference
+ */
+static int compare_times ( const void *first, const void *second ) {
+	const uint64_t *first_time = first;
+	const uint64_t *second_time = second;
+
+	if ( *first_time < *second_time )
+		return -1;
+	return ( *first_time > *second_time );
+}
+
+/**
+ * Run benchmark
+ *
+ * @v opts		Options
+ * @ret rc		Return status code
+ */
+static int bench ( struct options *opts ) {
+	struct bench_codec *codec;
+	struct bench_chunk *chunk;
+	uint64_t times[count];
+	uint64_t checksum;
+	uint64_t start;
+	uint64_t elapsed;
+	uint64_t total_time;
+	uint64_t total_len;
+	unsigned int n;
+	unsigned int rep;
+	unsigned int i;
+	size_t max_len = 0;
+	size_t j;
+	uint8_t *buf;
+	ssize_t out_len;
+	unsigned long xca_hits = 0;
+	unsigned long xca_misses = 0;
+
+	/* Allocate output buffer */
+	for ( i = 0 ; i < count ; i++ ) {
+		if ( max_len < chunks[i].out_len )
+			max_len = chunks[i].out_len;
+	}
+	buf = xmalloc ( max_len ? max_len : 1 );
+
+	/* Decompress each chunk, recording the fastest time */
+	for ( rep = 0 ; rep < opts->repeat ; rep++ ) {
+		for ( i = 0 ; i < count ; i++ ) {
+			chunk = &chunks[i];
+			start = now();
+			out_len = chunk->codec->decompress ( chunk->data,
+							     chunk->len, buf,
+							     chunk->out_len,
+							     chunk->window );
+			elapsed = ( now() - start );
+			if ( out_len != ( ssize_t ) chunk->out_len ) {
+				eprintf ( "%s chunk %d decompressed to %zd "
+					  "bytes (expected %zd)\n",
+					  chunk->codec->name, i, out_len,
+					  chunk->out_len );
+				exit ( 1 );
+			}
+			if ( chunk->time > elapsed )
+				chunk->time = elapsed;
+		}
+
+		/* Record alphabet reuse during first pass over corpus */
+		if ( rep == 0 ) {
+			xca_hits = xca_alphabet_hits;
+			xca_misses = xca_alphabet_misses;
+		}
+	}
+
+	/* Report on each decompressor */
+	printf ( "%-6s %7s %10s %8s %8s %8s %8s %8s  %s\n", "codec",
+		 "chunks", "bytes", "MB/s", "p50(us)", "p90(us)", "p99(us)",
+		 "max(us)", "checksum" );
+	for ( codec = bench_codecs ; codec < &bench_codecs[BENCH_CODECS] ;
+	      codec++ ) {
+
+		/* Calculate totals and output checksum (FNV-1a) */
+		n = 0;
+		total_time = total_len = 0;
+		checksum = 0xcbf29ce484222325ULL;
+		for ( i = 0 ; i < count ; i++ ) {
+			chunk = &chunks[i];
+			if ( chunk->codec != codec )
+				continue;
+			times[n++] = chunk->time;
+			total_time += chunk->time;
+			total_len += chunk->out_len;
+			codec->decompress ( chunk->data, chunk->len, buf,
+					    chunk->out_len, chunk->window );
+			for ( j = 0 ; j < chunk->out_len ; j++ ) {
+				checksum ^= buf[j];
+				checksum *= 0x100000001b3ULL;
+			}
+		}
+		if ( ! n )
+			continue;
+
+		/* Calculate latency percentiles */
+		qsort ( times, n, sizeof ( times[0] ), compare_times );
+		printf ( "%-6s %7d %10lld %8.1f %8.1f %8.1f %8.1f %8.1f  "
+			 "%016llx\n", codec->name, n,
+			 ( ( unsigned long long ) total_len ),
+			 ( ( total_len * 1000.0 ) /
+			   ( total_time ? total_time : 1 ) ),
+			 ( times[ ( ( n - 1 ) * 50 ) / 100 ] / 1000.0 ),
+			 ( times[ ( ( n - 1 ) * 90 ) / 100 ] / 1000.0 ),
+			 ( times[ ( ( n - 1 ) * 99 ) / 100 ] / 1000.0 ),
+			 ( times[ n - 1 ] / 1000.0 ),
+			 ( ( unsigned long long ) checksum ) );
+	}
+
+	/* Report on XCA Huffman alphabet reuse */
+	if ( xca_hits || xca_misses ) {
+		printf ( "xca Huffman alphabets: %lu reused, %lu constructed "
+			 "(%.1f%% reuse)\n", xca_hits, xca_misses,
+			 ( ( xca_hits * 100.0 ) / ( xca_hits + xca_misses ) ) );
+	}
+
+	free ( buf );
+	return 0;
+}
+
+/**
+ * Print help
+ *
+ * @v program_name	Program name
+ */
+static void print_help ( const char *program_name ) {
+	eprintf ( "Syntax: %s [--repeat=<count>] file...\n", program_name );
+}
+
+/**
+ * Parse command-line options
+ *
+ * @v argc		Argument count
+ * @v argv		Argument list
+ * @v opts		Options structure to populate
+ */
+static int parse_options ( const int argc, char **argv,
+			   struct options *opts ) {
+	char *end;
+	int c;
+
+	while (1) {
+		int option_index = 0;
+		static struct option long_options[] = {
+			{ "repeat", required_argument, NULL, 'r' },
+			{ "help", 0, NULL, 'h' },
+			{ 0, 0, 0, 0 }
+		};
+
+		if ( ( c = getopt_long ( argc, argv, "r:h",
+					 long_options,
+					 &option_index ) ) == -1 ) {
+			break;
+		}
+
+		switch ( c ) {
+		case 'r':
+			opts->repeat = strtoul ( optarg, &end, 0 );
+			if ( *end || ( ! *optarg ) || ( ! opts->repeat ) ) {
+				eprintf ( "Invalid repeat count \"%s\"\n",
+					  optarg );
+				exit ( 2 );
+			}
+			break;
+		case 'h':
+			print_help ( argv[0] );
+			exit ( 0 );
+		case '?':
+		default:
+			exit ( 2 );
+		}
+	}
+	return optind;
+}
+
+int main ( int argc, char **argv ) {
+	struct options opts = {
+		.repeat = 5,
+	};
+	int infile_index;
+	int i;
+
+	/* Parse command-line arguments */
+	infile_index = parse_options ( argc, argv, &opts );
+	if ( argc == infile_index ) {
+		print_help ( argv[0] );
+		exit ( 2 );
+	}
+
+	/* Build corpus */
+	for ( i = infile_index ; i < argc ; i++ )
+		add_file ( argv[i] );
+
+#ifdef BENCH_WIMLIB
+	/* Compare against reference implementation */
+	if ( compare() != 0 )
+		exit ( 1 );
+#endif
+
+	/* Run benchmark */
+	return bench ( &opts );
+}
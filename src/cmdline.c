@@ -56,6 +56,15 @@ int cmdline_linear;
 /** WIM boot index */
 unsigned int cmdline_index;
 
+/** Number of decompressed WIM chunks to cache */
+unsigned int cmdline_chunks = 8;
+
+/** Maximum number of WIM chunks to read ahead */
+unsigned int cmdline_readahead = 4;
+
+/** Verify one in every N injected file hashes listed in a manifest */
+unsigned int cmdline_verify;
+
 /**
  * Process command line
  *
@@ -115,6 +124,27 @@ void process_cmdline ( char *cmdline ) {
 			cmdline_index = strtoul ( value, &endp, 0 );
 			if ( *endp )
 				die ( "Invalid index \"%s\"\n", value );
+		} else if ( strcmp ( key, "chunks" ) == 0 ) {
+			if ( ( ! value ) || ( ! value[0] ) )
+				die ( "Argument \"chunks\" needs a value\n" );
+			cmdline_chunks = strtoul ( value, &endp, 0 );
+			if ( *endp || ( ! cmdline_chunks ) )
+				die ( "Invalid chunk count \"%s\"\n", value );
+		} else if ( strcmp ( key, "readahead" ) == 0 ) {
+			if ( ( ! value ) || ( ! value[0] ) )
+				die ( "Argument \"readahead\" needs a value\n" );
+			cmdline_readahead = strtoul ( value, &endp, 0 );
+			if ( *endp )
+				die ( "Invalid read-ahead count \"%s\"\n", value );
+		} else if ( strcmp ( key, "verify" ) == 0 ) {
+			cmdline_verify = 1;
+			if ( value ) {
+				cmdline_verify = strtoul ( value, &endp, 0 );
+				if ( *endp || ( ! cmdline_verify ) ) {
+					die ( "Invalid verification interval "
+					      "\"%s\"\n", value );
+				}
+			}
 		} else if ( strcmp ( key, "initrdfile" ) == 0 ) {
 			/* Ignore this keyword to allow for use with syslinux */
 		} else if ( key == cmdline ) {
@@ -35,6 +35,9 @@ extern int cmdline_pause;
 extern int cmdline_pause_quiet;
 extern int cmdline_linear;
 extern unsigned int cmdline_index;
+extern unsigned int cmdline_chunks;
+extern unsigned int cmdline_readahead;
+extern unsigned int cmdline_verify;
 extern void process_cmdline ( char *cmdline );
 
 #endif /* _CMDLINE_H */
@@ -42,6 +42,13 @@ static inline int toupper ( int c ) {
 	return c;
 }
 
+static inline int tolower ( int c ) {
+
+	if ( isupper ( c ) )
+		c += ( 'a' - 'A' );
+	return c;
+}
+
 extern int isspace ( int c );
 
 #endif /* _CTYPE_H */
@@ -37,15 +37,13 @@
 #include "efipath.h"
 #include "efifile.h"
 
-/** bootmgfw.efi path within WIM */
-static const wchar_t bootmgfw_path[] = L"\\Windows\\Boot\\EFI\\bootmgfw.efi";
+/** Number of bootloader paths within WIM */
+#define EFI_WIM_BOOT_PATHS 2
 
-/** bootmgfw_EX.efi path within WIM */
-static const wchar_t bootmgfw_ex_path[] =
-	L"\\Windows\\Boot\\EFI_EX\\bootmgfw_EX.efi";
-
-/** Other paths within WIM */
+/** Paths within WIM (with bootmgfw.efi and bootmgfw_EX.efi first) */
 static const wchar_t *efi_wim_paths[] = {
+	L"\\Windows\\Boot\\EFI\\bootmgfw.efi",
+	L"\\Windows\\Boot\\EFI_EX\\bootmgfw_EX.efi",
 	L"\\Windows\\Boot\\DVD\\EFI\\boot.sdi",
 	L"\\Windows\\Boot\\DVD\\EFI\\BCD",
 	L"\\Windows\\Boot\\EFI\\boot.stl",
@@ -137,11 +135,14 @@ void efi_extract ( EFI_HANDLE handle ) {
 		CHAR16 name[ VDISK_NAME_LEN + 1 /* WNUL */ ];
 	} __attribute__ (( packed )) info;
 	char name[ VDISK_NAME_LEN + 1 /* NUL */ ];
+	struct vdisk_file *files[ sizeof ( efi_wim_paths ) /
+				  sizeof ( efi_wim_paths[0] ) ];
 	struct vdisk_file *wim = NULL;
 	struct vdisk_file *bootarch = NULL;
 	struct vdisk_file *vfile;
 	EFI_FILE_PROTOCOL *root;
 	EFI_FILE_PROTOCOL *file;
+	unsigned int skip;
 	UINTN size;
 	CHAR16 *wname;
 	EFI_STATUS efirc;
@@ -224,22 +225,20 @@ void efi_extract ( EFI_HANDLE handle ) {
 		bootmgfw_ex = NULL;
 	}
 
-	/* Extract bootloader(s) from WIM if none are explicitly provided */
-	if ( wim && ( ! bootmgfw ) && ( ! bootmgfw_ex ) ) {
-		if ( ( bootmgfw = wim_add_file ( wim, cmdline_index,
-						 bootmgfw_path ) ) ) {
-			DBG ( "...extracted %ls\n", bootmgfw_path );
-		}
-		if ( ( bootmgfw_ex = wim_add_file ( wim, cmdline_index,
-						    bootmgfw_ex_path ) ) ) {
-			DBG ( "...extracted %ls\n", bootmgfw_ex_path );
-		}
-	}
-
-	/* Process WIM image */
+	/* Process WIM image, extracting bootloader(s) from WIM if
+	 * none are explicitly provided.
+	 */
 	if ( wim ) {
 		vdisk_patch_file ( wim, patch_wim );
-		wim_add_files ( wim, cmdline_index, efi_wim_paths );
+		skip = ( ( bootmgfw || bootmgfw_ex ) ? EFI_WIM_BOOT_PATHS : 0 );
+		wim_add_files ( wim, cmdline_index, ( efi_wim_paths + skip ),
+				( files + skip ) );
+		if ( ! skip ) {
+			if ( ( bootmgfw = files[0] ) )
+				DBG ( "...extracted %s\n", bootmgfw->name );
+			if ( ( bootmgfw_ex = files[1] ) )
+				DBG ( "...extracted %s\n", bootmgfw_ex->name );
+		}
 	}
 
 	/* Check that we have a boot file */
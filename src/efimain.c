@@ -31,6 +31,7 @@
 #include "efifile.h"
 #include "efiblock.h"
 #include "efiboot.h"
+#include "malloc.h"
 
 /** SBAT section attributes */
 #define __sbat __attribute__ (( section ( ".sbat" ), aligned ( 512 ) ))
@@ -66,6 +67,33 @@ static void efi_cmdline ( EFI_LOADED_IMAGE_PROTOCOL *loaded ) {
 	process_cmdline ( cmdline );
 }
 
+/**
+ * Reserve memory from firmware
+ *
+ * @v len		Length
+ * @ret ptr		Memory, or NULL on failure
+ */
+static void * efi_reserve ( size_t len ) {
+	EFI_BOOT_SERVICES *bs = efi_systab->BootServices;
+	EFI_PHYSICAL_ADDRESS phys;
+	EFI_STATUS efirc;
+	void *ptr;
+
+	/* Allocate pages */
+	if ( ( efirc = bs->AllocatePages ( AllocateAnyPages,
+					   EfiBootServicesData,
+					   ( ( len + PAGE_SIZE - 1 ) /
+					     PAGE_SIZE ), &phys ) ) != 0 ) {
+		DBG ( "Could not reserve %#zx bytes: %#lx\n",
+		      len, ( ( unsigned long ) efirc ) );
+		return NULL;
+	}
+	ptr = ( ( void * ) ( intptr_t ) phys );
+	DBG ( "Reserved [%p,%p)\n", ptr, ( ptr + len ) );
+
+	return ptr;
+}
+
 /**
  * EFI entry point
  *
@@ -82,6 +110,7 @@ EFI_STATUS EFIAPI efi_main ( EFI_HANDLE image_handle,
 	} loaded;
 	EFI_HANDLE vdisk = NULL;
 	EFI_HANDLE vpartition = NULL;
+	EFI_PHYSICAL_ADDRESS heap;
 	EFI_STATUS efirc;
 
 	/* Record EFI handle and system table */
@@ -108,6 +137,21 @@ EFI_STATUS EFIAPI efi_main ( EFI_HANDLE image_handle,
 	/* Process command line */
 	efi_cmdline ( loaded.image );
 
+	/* Allocate heap */
+	if ( ( efirc = bs->AllocatePages ( AllocateAnyPages,
+					   EfiBootServicesData,
+					   ( HEAP_SIZE / PAGE_SIZE ),
+					   &heap ) ) == 0 ) {
+		mpopulate ( ( ( void * ) ( intptr_t ) heap ), HEAP_SIZE );
+	} else {
+		DBG ( "Could not allocate heap: %#lx\n",
+		      ( ( unsigned long ) efirc ) );
+	}
+
+	/* Allow large buffers to be reserved from firmware */
+	mreserve = efi_reserve;
+	mreserve_persistent = 1;
+
 	/* Extract files from file system */
 	efi_extract ( loaded.image->DeviceHandle );
 
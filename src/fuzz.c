@@ -0,0 +1,329 @@
+/*
+ * Copyright (C) 2026 Michael Brown <mbrown@fensystems.co.uk>.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * @file
+ *
+ * Decompressor fuzzing entry point
+ *
+ * The first byte of each input selects the decompressor, and the
+ * remainder is used as the compressed data.  Beyond the sanitisers'
+ * own checks, this verifies that each decompressor's output is fully
+ * determined by its input (i.e. that nothing is read from an
+ * uninitialised part of the output buffer), that a length-only pass
+ * (where supported) agrees with a full decompression, and that
+ * decompression suspended and resumed at arbitrary points (where
+ * supported) produces the same output.
+ *
+ * Build with libFuzzer via "make wimfuzz", or with FUZZ_STANDALONE
+ * defined (e.g. for AFL, or to reproduce a crash) via "make
+ * wimfuzz-standalone", in which case each file named on the command
+ * line (or standard input) is processed in turn.
+ *
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "wimboot.h"
+#include "lzx.h"
+#include "xca.h"
+#include "lznt1.h"
+#include "lzms.h"
+
+/** Maximum decompressed length */
+#define FUZZ_MAX_LEN ( 2 * 65536 )
+
+/** Suppress debug messages from decompressors */
+int cmdline_quiet = 1;
+
+/** A decompressor */
+struct fuzz_codec {
+	/** Decompress data
+	 *
+	 * @v data		Compressed data
+	 * @v len		Length of compressed data
+	 * @v buf		Decompression buffer, or NULL
+	 * @v max_len		Length of decompression buffer
+	 * @ret out_len		Length of decompressed data, or negative error
+	 */
+	ssize_t ( * decompress ) ( const void *data, size_t len, void *buf,
+				   size_t max_len );
+	/** Decompressor supports a length-only pass */
+	int probe;
+	/** Decompress data in steps, or NULL if not supported
+	 *
+	 * @v data		Compressed data
+	 * @v len		Length of compressed data
+	 * @v buf		Decompression buffer
+	 * @v max_len		Length of decompression buffer
+	 * @v step		Additional output required at each step
+	 * @ret out_len		Length of decompressed data, or negative error
+	 */
+	ssize_t ( * resume ) ( const void *data, size_t len, void *buf,
+			       size_t max_len, size_t step );
+};
+
+/** Output buffers */
+static uint8_t fuzz_buf[3][FUZZ_MAX_LEN];
+
+/**
+ * Decompress LZX-compressed data in steps
+ *
+ * @v data		Compressed data
+ * @v len		Length of compressed data
+ * @v buf		Decompression buffer
+ * @v max_len		Length of decompression buffer
+ * @v window		Window size
+ * @v step		Additional output required at each step
+ * @ret out_len		Length of decompressed data, or negative error
+ */
+static ssize_t fuzz_lzx_steps ( const void *data, size_t len, void *buf,
+				size_t max_len, size_t window, size_t step ) {
+	static struct lzx lzx;
+	static uint8_t lzx_window[FUZZ_MAX_LEN];
+	size_t want = 0;
+	ssize_t out_len;
+	int rc;
+
+	if ( ( rc = lzx_init ( &lzx, data, len, lzx_window, max_len,
+			       window ) ) != 0 )
+		return rc;
+	do {
+		want += step;
+		out_len = lzx_resume ( &lzx, buf, want );
+	} while ( ( out_len >= 0 ) && ( ( ( size_t ) out_len ) >= want ) &&
+		  ( want < max_len ) );
+	return out_len;
+}
+
+/**
+ * Decompress LZX-compressed data in steps
+ *
+ * @v data		Compressed data
+ * @v len		Length of compressed data
+ * @v buf		Decompression buffer
+ * @v max_len		Length of decompression buffer
+ * @v step		Additional output required at each step
+ * @ret out_len		Length of decompressed data, or negative error
+ */
+static ssize_t fuzz_lzx_resume ( const void *data, size_t len, void *buf,
+				 size_t max_len, size_t step ) {
+
+	return fuzz_lzx_steps ( data, len, buf, max_len, LZX_DEFAULT_WINDOW,
+				step );
+}
+
+/**
+ * Decompress LZX-compressed data with the maximum window size
+ *
+ * @v data		Compressed data
+ * @v len		Length of compressed data
+ * @v buf		Decompression buffer, or NULL
+ * @v max_len		Length of decompression buffer
+ * @ret out_len		Length of decompressed data, or negative error
+ */
+static ssize_t fuzz_lzx_wide ( const void *data, size_t len, void *buf,
+			       size_t max_len ) {
+
+	return lzx_decompress_window ( data, len, buf, max_len,
+				       LZX_MAX_WINDOW );
+}
+
+/**
+ * Decompress LZX-compressed data with the maximum window size in steps
+ *
+ * @v data		Compressed data
+ * @v len		Length of compressed data
+ * @v buf		Decompression buffer
+ * @v max_len		Length of decompression buffer
+ * @v step		Additional output required at each step
+ * @ret out_len		Length of decompressed data, or negative error
+ */
+static ssize_t fuzz_lzx_wide_resume ( const void *data, size_t len,
+				      void *buf, size_t max_len,
+				      size_t step ) {
+
+	return fuzz_lzx_steps ( data, len, buf, max_len, LZX_MAX_WINDOW,
+				step );
+}
+
+/**
+ * Decompress XCA-compressed data in steps
+ *
+ * @v data		Compressed data
+ * @v len		Length of compressed data
+ * @v buf		Decompression buffer
+ * @v max_len		Length of decompression buffer
+ * @v step		Additional output required at each step
+ * @ret out_len		Length of decompressed data, or negative error
+ */
+static ssize_t fuzz_xca_resume ( const void *data, size_t len, void *buf,
+				 size_t max_len, size_t step ) {
+	static struct xca xca;
+	size_t want = 0;
+	ssize_t out_len;
+
+	xca_init ( &xca, data, len, buf, max_len );
+	do {
+		want += step;
+		out_len = xca_resume ( &xca, want );
+	} while ( ( out_len >= 0 ) && ( ( ( size_t ) out_len ) >= want ) );
+	return out_len;
+}
+
+/**
+ * Decompress LZMS-compressed data
+ *
+ * @v data		Compressed data
+ * @v len		Length of compressed data
+ * @v buf		Decompression buffer
+ * @v max_len		Length of decompression buffer
+ * @ret out_len		Length of decompressed data, or negative error
+ *
+ * LZMS-compressed data does not record its own length, so the
+ * decompressed length is derived from the compressed length.
+ */
+static ssize_t fuzz_lzms ( const void *data, size_t len, void *buf,
+			   size_t max_len ) {
+
+	if ( max_len > ( 16 * len ) )
+		max_len = ( 16 * len );
+	return lzms_decompress ( data, len, buf, max_len );
+}
+
+/** Decompressors */
+static struct fuzz_codec fuzz_codecs[] = {
+	{ lzx_decompress, 0, fuzz_lzx_resume },
+	{ xca_decompress, 1, fuzz_xca_resume },
+	{ lznt1_decompress, 1, NULL },
+	{ fuzz_lzx_wide, 0, fuzz_lzx_wide_resume },
+	{ fuzz_lzms, 0, NULL },
+};
+
+/**
+ * Process fuzzer input
+ *
+ * @v data		Input data
+ * @v size		Length of input data
+ * @ret rc		Return status code (always zero)
+ */
+int LLVMFuzzerTestOneInput ( const uint8_t *data, size_t size ) {
+	struct fuzz_codec *codec;
+	ssize_t len[2];
+	ssize_t probe_len;
+	ssize_t resume_len;
+	size_t step;
+	unsigned int i;
+	void *copy;
+
+	/* Select decompressor and resumption step size */
+	if ( ! size )
+		return 0;
+	codec = &fuzz_codecs[ data[0] % ( sizeof ( fuzz_codecs ) /
+					  sizeof ( fuzz_codecs[0] ) ) ];
+	step = ( 1 + ( data[0] * data[0] * 7 ) );
+
+	/* Copy compressed data to an exactly-sized (and aligned)
+	 * buffer, so that any overrun is caught by the sanitisers.
+	 */
+	size--;
+	copy = malloc ( size ? size : 1 );
+	if ( ! copy )
+		return 0;
+	memcpy ( copy, ( data + 1 ), size );
+	data = copy;
+
+	/* Decompress into buffers with differing initial contents */
+	for ( i = 0 ; i < 2 ; i++ ) {
+		memset ( fuzz_buf[i], ( i ? 0xff : 0x00 ),
+			 sizeof ( fuzz_buf[i] ) );
+		len[i] = codec->decompress ( data, size, fuzz_buf[i],
+					     sizeof ( fuzz_buf[i] ) );
+	}
+
+	/* Check that output is fully determined by the input */
+	if ( len[0] != len[1] )
+		abort();
+	if ( ( len[0] > 0 ) && memcmp ( fuzz_buf[0], fuzz_buf[1], len[0] ) )
+		abort();
+
+	/* Check that a length-only pass agrees */
+	if ( codec->probe && ( len[0] >= 0 ) ) {
+		probe_len = codec->decompress ( data, size, NULL, 0 );
+		if ( probe_len != len[0] )
+			abort();
+	}
+
+	/* Check that resumed decompression agrees */
+	if ( codec->resume && ( len[0] >= 0 ) ) {
+		memset ( fuzz_buf[2], 0xaa, sizeof ( fuzz_buf[2] ) );
+		resume_len = codec->resume ( data, size, fuzz_buf[2],
+					     sizeof ( fuzz_buf[2] ), step );
+		if ( ( resume_len != len[0] ) ||
+		     memcmp ( fuzz_buf[0], fuzz_buf[2], len[0] ) )
+			abort();
+	}
+
+	free ( copy );
+	return 0;
+}
+
+#ifdef FUZZ_STANDALONE
+
+/**
+ * Process input file
+ *
+ * @v file		Input file
+ */
+static void fuzz_file ( FILE *file ) {
+	static uint8_t data[ 16 * FUZZ_MAX_LEN ];
+	size_t len;
+
+	len = fread ( data, 1, sizeof ( data ), file );
+	LLVMFuzzerTestOneInput ( data, len );
+}
+
+int main ( int argc, char **argv ) {
+	FILE *file;
+	int i;
+
+	/* Process standard input if no files are specified */
+	if ( argc < 2 ) {
+		fuzz_file ( stdin );
+		return 0;
+	}
+
+	/* Process each file */
+	for ( i = 1 ; i < argc ; i++ ) {
+		file = fopen ( argv[i], "rb" );
+		if ( ! file ) {
+			perror ( argv[i] );
+			return 1;
+		}
+		fuzz_file ( file );
+		fclose ( file );
+	}
+
+	return 0;
+}
+
+#endif /* FUZZ_STANDALONE */
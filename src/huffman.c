@@ -84,7 +84,8 @@ huffman_dump_alphabet ( struct huffman_alphabet *alphabet ) {
 	DBG ( "Huffman quick lookup:" );
 	for ( i = 0 ; i < ( sizeof ( alphabet->lookup ) /
 			    sizeof ( alphabet->lookup[0] ) ) ; i++ ) {
-		DBG ( " %d", ( alphabet->lookup[i] + 1 ) );
+		DBG ( " %03x/%d", huffman_raw ( alphabet->lookup[i] ),
+		      huffman_len ( alphabet->lookup[i] ) );
 	}
 	DBG ( "\n" );
 }
@@ -106,6 +107,8 @@ int huffman_alphabet ( struct huffman_alphabet *alphabet,
 	unsigned int raw;
 	unsigned int adjustment;
 	unsigned int prefix;
+	unsigned int limit;
+	huffman_lookup_t entry;
 	int empty;
 	int complete;
 
@@ -127,8 +130,10 @@ int huffman_alphabet ( struct huffman_alphabet *alphabet,
 	 * single-bit codes.  This allows callers to avoid having to
 	 * check for this special case.
 	 */
-	if ( empty )
+	if ( empty ) {
 		alphabet->huf[0].freq = 2;
+		alphabet->raw[0] = alphabet->raw[1] = 0;
+	}
 
 	/* Populate Huffman-coded symbol table */
 	huf = 0;
@@ -172,10 +177,24 @@ int huffman_alphabet ( struct huffman_alphabet *alphabet,
 		adjustment = ( sym->start >> sym->shift );
 		sym->raw -= adjustment; /* Adjust for quick indexing */
 
-		/* Populate quick lookup table */
-		for ( prefix = ( sym->start >> HUFFMAN_QL_SHIFT ) ;
-		      prefix < ( 1 << HUFFMAN_QL_BITS ) ; prefix++ ) {
-			alphabet->lookup[prefix] = ( bits - 1 );
+		/* Populate quick lookup table.  Short symbols are
+		 * recorded directly.  For prefixes of longer symbols,
+		 * record the maximum symbol length that may share the
+		 * prefix.
+		 */
+		prefix = ( sym->start >> HUFFMAN_QL_SHIFT );
+		entry = ( ( bits - 1 ) << HUFFMAN_LOOKUP_LEN_SHIFT );
+		if ( bits <= HUFFMAN_QL_BITS ) {
+			limit = ( prefix +
+				  ( sym->freq << ( HUFFMAN_QL_BITS - bits ) ) );
+			for ( ; prefix < limit ; prefix++ ) {
+				raw = sym->raw[ prefix >>
+						( HUFFMAN_QL_BITS - bits ) ];
+				alphabet->lookup[prefix] = ( entry | raw );
+			}
+		} else {
+			for ( ; prefix < ( 1 << HUFFMAN_QL_BITS ) ; prefix++ )
+				alphabet->lookup[prefix] = entry;
 		}
 	}
 
@@ -189,21 +208,24 @@ int huffman_alphabet ( struct huffman_alphabet *alphabet,
 }
 
 /**
- * Get Huffman symbol set
+ * Get Huffman symbol longer than the quick lookup length
  *
  * @v alphabet		Huffman alphabet
  * @v huf		Raw input value (normalised to HUFFMAN_BITS bits)
- * @ret sym		Huffman symbol set
+ * @ret entry		Quick lookup table entry for symbol
  */
-struct huffman_symbols * huffman_sym ( struct huffman_alphabet *alphabet,
-				       unsigned int huf ) {
+huffman_lookup_t huffman_sym ( struct huffman_alphabet *alphabet,
+			       unsigned int huf ) {
 	struct huffman_symbols *sym;
-	unsigned int lookup_index;
+	huffman_lookup_t entry;
 
 	/* Find symbol set for this length */
-	lookup_index = ( huf >> HUFFMAN_QL_SHIFT );
-	sym = &alphabet->huf[ alphabet->lookup[ lookup_index ] ];
+	entry = alphabet->lookup[ huf >> HUFFMAN_QL_SHIFT ];
+	sym = &alphabet->huf[ huffman_len ( entry ) - 1 ];
 	while ( huf < sym->start )
 		sym--;
-	return sym;
+
+	/* Construct quick lookup table entry */
+	return ( ( ( sym->bits - 1 ) << HUFFMAN_LOOKUP_LEN_SHIFT ) |
+		 sym->raw[ huf >> sym->shift ] );
 }
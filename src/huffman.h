@@ -39,11 +39,30 @@ typedef uint16_t huffman_raw_symbol_t;
  *
  * This is a policy decision.
  */
-#define HUFFMAN_QL_BITS 7
+#define HUFFMAN_QL_BITS 10
 
 /** Quick lookup shift */
 #define HUFFMAN_QL_SHIFT ( HUFFMAN_BITS - HUFFMAN_QL_BITS )
 
+/** A Huffman quick lookup table entry
+ *
+ * For symbols of at most HUFFMAN_QL_BITS bits, this holds the raw
+ * symbol value and the symbol length.  For longer symbols, this holds
+ * only the maximum length of any symbol sharing this prefix; the
+ * symbol must then be found by searching the Huffman-coded symbol
+ * sets.
+ */
+typedef uint16_t huffman_lookup_t;
+
+/** Raw symbol value mask within quick lookup table entry */
+#define HUFFMAN_LOOKUP_RAW_MASK 0x0fff
+
+/** Symbol length shift within quick lookup table entry
+ *
+ * The symbol length is stored as ( length - 1 ).
+ */
+#define HUFFMAN_LOOKUP_LEN_SHIFT 12
+
 /** A Huffman-coded set of symbols of a given length */
 struct huffman_symbols {
 	/** Length of Huffman-coded symbols (in bits) */
@@ -68,7 +87,7 @@ struct huffman_alphabet {
 	/** Huffman-coded symbol set for each length */
 	struct huffman_symbols huf[HUFFMAN_BITS];
 	/** Quick lookup table */
-	uint8_t lookup[ 1 << HUFFMAN_QL_BITS ];
+	huffman_lookup_t lookup[ 1 << HUFFMAN_QL_BITS ];
 	/** Raw symbols
 	 *
 	 * Ordered by Huffman-coded symbol length, then by symbol
@@ -80,31 +99,48 @@ struct huffman_alphabet {
 /**
  * Get Huffman symbol length
  *
- * @v sym		Huffman symbol set
+ * @v entry		Quick lookup table entry
  * @ret len		Length (in bits)
  */
 static inline __attribute__ (( always_inline )) unsigned int
-huffman_len ( struct huffman_symbols *sym ) {
+huffman_len ( huffman_lookup_t entry ) {
 
-	return sym->bits;
+	return ( ( entry >> HUFFMAN_LOOKUP_LEN_SHIFT ) + 1 );
 }
 
 /**
  * Get Huffman symbol value
  *
- * @v sym		Huffman symbol set
- * @v huf		Raw input value (normalised to HUFFMAN_BITS bits)
+ * @v entry		Quick lookup table entry
  * @ret raw		Raw symbol value
  */
 static inline __attribute__ (( always_inline )) huffman_raw_symbol_t
-huffman_raw ( struct huffman_symbols *sym, unsigned int huf ) {
+huffman_raw ( huffman_lookup_t entry ) {
 
-	return sym->raw[ huf >> sym->shift ];
+	return ( entry & HUFFMAN_LOOKUP_RAW_MASK );
 }
 
 extern int huffman_alphabet ( struct huffman_alphabet *alphabet,
 			      uint8_t *lengths, unsigned int count );
-extern struct huffman_symbols *
-huffman_sym ( struct huffman_alphabet *alphabet, unsigned int huf );
+extern huffman_lookup_t huffman_sym ( struct huffman_alphabet *alphabet,
+				      unsigned int huf );
+
+/**
+ * Decode Huffman symbol
+ *
+ * @v alphabet		Huffman alphabet
+ * @v huf		Raw input value (normalised to HUFFMAN_BITS bits)
+ * @ret entry		Quick lookup table entry for symbol
+ */
+static inline __attribute__ (( always_inline )) huffman_lookup_t
+huffman_decode ( struct huffman_alphabet *alphabet, unsigned int huf ) {
+	huffman_lookup_t entry;
+
+	/* Look up symbol, searching for longer symbols if necessary */
+	entry = alphabet->lookup[ huf >> HUFFMAN_QL_SHIFT ];
+	if ( unlikely ( huffman_len ( entry ) > HUFFMAN_QL_BITS ) )
+		entry = huffman_sym ( alphabet, huf );
+	return entry;
+}
 
 #endif /* _HUFFMAN_H */
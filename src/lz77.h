@@ -0,0 +1,91 @@
+#ifndef _LZ77_H
+#define _LZ77_H
+
+/*
+ * Copyright (C) 2026 Michael Brown <mbrown@fensystems.co.uk>.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * @file
+ *
+ * LZ77 match copying
+ *
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+/** An LZ77 copy word */
+typedef unsigned long lz77_word_t;
+
+/**
+ * Copy LZ77 match
+ *
+ * @v dest		Destination
+ * @v offset		Match offset (must be non-zero)
+ * @v len		Match length
+ * @ret dest		End of destination
+ *
+ * The match source lies @c offset bytes before the destination, and
+ * may overlap it.  The result is identical to a byte-by-byte forward
+ * copy, and nothing beyond the end of the match is read or written.
+ */
+static inline __attribute__ (( always_inline )) uint8_t *
+lz77_copy ( uint8_t *dest, size_t offset, size_t len ) {
+	const uint8_t *src = ( dest - offset );
+	lz77_word_t word;
+	size_t stride;
+	size_t skip;
+
+	/* Use word copies where at least one whole word remains */
+	if ( len >= sizeof ( word ) ) {
+
+		/* A short offset produces a pattern that repeats every
+		 * @c offset bytes, and therefore also repeats every
+		 * multiple of @c offset bytes.  Copy single bytes
+		 * until the copy source can be moved back to the
+		 * first multiple of @c offset that is at least one
+		 * word behind the destination.
+		 */
+		if ( offset < sizeof ( word ) ) {
+			stride = ( ( ( sizeof ( word ) + offset - 1 ) /
+				     offset ) * offset );
+			for ( skip = ( stride - offset ) ; skip ; skip-- )
+				*(dest++) = *(src++);
+			len -= ( stride - offset );
+			src = ( dest - stride );
+		}
+
+		/* Copy whole words (which can no longer overlap) */
+		while ( len >= sizeof ( word ) ) {
+			__builtin_memcpy ( &word, src, sizeof ( word ) );
+			__builtin_memcpy ( dest, &word, sizeof ( word ) );
+			src += sizeof ( word );
+			dest += sizeof ( word );
+			len -= sizeof ( word );
+		}
+	}
+
+	/* Copy any remaining bytes */
+	while ( len-- )
+		*(dest++) = *(src++);
+
+	return dest;
+}
+
+#endif /* _LZ77_H */
@@ -0,0 +1,735 @@
+/*
+ * Copyright (C) 2026 Michael Brown <mbrown@fensystems.co.uk>.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * @file
+ *
+ * LZMS decompression
+ *
+ * LZMS is not publicly documented.  This algorithm is derived from
+ * the files lzms_decompress.c and lzms_common.c in the wimlib source
+ * code.
+ *
+ * The compressed data consists of a range-coded stream of binary
+ * decisions, read forwards from the start of the data, interleaved
+ * with a stream of adaptive Huffman-coded symbols, read backwards
+ * from the end of the data.
+ *
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "wimboot.h"
+#include "huffman.h"
+#include "lz77.h"
+#include "lzms.h"
+
+/** Base values, indexed by offset slot */
+static uint32_t lzms_offset_base[ LZMS_OFFSET_SLOTS + 1 ];
+
+/** Extra bits, indexed by offset slot */
+static uint8_t lzms_offset_bits[LZMS_OFFSET_SLOTS];
+
+/** Base values, indexed by length slot */
+static uint32_t lzms_length_base[ LZMS_LENGTH_SLOTS + 1 ];
+
+/** Extra bits, indexed by length slot */
+static uint8_t lzms_length_bits[LZMS_LENGTH_SLOTS];
+
+/** Number of offset slots with each power-of-two base value spacing */
+static const uint8_t lzms_offset_runs[] = {
+	9, 0, 9, 7, 10, 15, 15, 20, 20, 30, 33, 40, 42, 45, 60, 73, 80, 85,
+	95, 105, 6
+};
+
+/** Number of length slots with each power-of-two base value spacing */
+static const uint8_t lzms_length_runs[] = {
+	27, 4, 6, 4, 5, 2, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 1
+};
+
+/** Most recently seen position for each x86 jump target */
+static int32_t *lzms_x86_targets;
+
+/**
+ * Construct slot tables
+ *
+ * @v base		Base value table to fill in
+ * @v bits		Extra bits table to fill in
+ * @v count		Number of slots
+ * @v runs		Number of slots with each base value spacing
+ * @v limit		Upper limit for values within the final slot
+ */
+static void lzms_slots ( uint32_t *base, uint8_t *bits, unsigned int count,
+			 const uint8_t *runs, uint32_t limit ) {
+	uint32_t value = 0;
+	unsigned int order;
+	unsigned int slot;
+	unsigned int run;
+
+	/* Calculate base values */
+	for ( slot = 0, order = 0 ; slot < count ; order++ ) {
+		for ( run = runs[order] ; run ; run-- ) {
+			value += ( 1UL << order );
+			base[slot++] = value;
+		}
+	}
+	base[count] = limit;
+
+	/* Calculate extra bits */
+	for ( slot = 0 ; slot < count ; slot++ ) {
+		bits[slot] = ( ( 8 * sizeof ( base[0] ) ) - 1 -
+			       __builtin_clz ( base[ slot + 1 ] - base[slot] ) );
+	}
+}
+
+/**
+ * Initialise binary decision
+ *
+ * @v decision		Binary decision
+ * @v states		Number of states
+ */
+static void lzms_decision_init ( struct lzms_decision *decision,
+				 unsigned int states ) {
+	struct lzms_probability *probability;
+	unsigned int i;
+
+	decision->state = 0;
+	decision->states = states;
+	for ( i = 0 ; i < states ; i++ ) {
+		probability = &decision->probability[i];
+		probability->zeros = LZMS_INITIAL_ZEROS;
+		probability->recent = LZMS_INITIAL_RECENT;
+	}
+}
+
+/**
+ * Decode binary decision
+ *
+ * @v lzms		Decompressor
+ * @v decision		Binary decision
+ * @ret bit		Decoded bit
+ */
+static int lzms_bit ( struct lzms *lzms, struct lzms_decision *decision ) {
+	struct lzms_probability *probability;
+	unsigned int zeros;
+	uint32_t bound;
+	int bit;
+
+	/* Get probability of a zero bit, excluding certainty */
+	probability = &decision->probability[decision->state];
+	zeros = probability->zeros;
+	if ( ! zeros )
+		zeros++;
+	if ( zeros == ( 1U << LZMS_PROBABILITY_BITS ) )
+		zeros--;
+
+	/* Normalise range */
+	if ( ! ( lzms->range & 0xffff0000UL ) ) {
+		lzms->range <<= 16;
+		lzms->code <<= 16;
+		if ( lzms->range_next < lzms->range_end )
+			lzms->code |= *(lzms->range_next++);
+	}
+
+	/* Decode bit */
+	bound = ( ( lzms->range >> LZMS_PROBABILITY_BITS ) * zeros );
+	bit = ( lzms->code >= bound );
+	if ( bit ) {
+		lzms->range -= bound;
+		lzms->code -= bound;
+	} else {
+		lzms->range = bound;
+	}
+
+	/* Update probability and state */
+	probability->zeros += ( probability->recent >> 63 );
+	probability->zeros -= bit;
+	probability->recent = ( ( probability->recent << 1 ) | bit );
+	decision->state = ( ( ( decision->state << 1 ) | bit ) &
+			    ( decision->states - 1 ) );
+
+	return bit;
+}
+
+/**
+ * Refill bit accumulator
+ *
+ * @v lzms		Decompressor
+ *
+ * Ensures that at least 16 bits are available.  Data beyond the
+ * start of the bitstream reads as zero.
+ */
+static inline __attribute__ (( always_inline )) void
+lzms_refill ( struct lzms *lzms ) {
+
+	while ( lzms->bits < 16 ) {
+		if ( lzms->bits_next > lzms->bits_start ) {
+			lzms->accumulator |=
+				( ( ( uint32_t ) *(--lzms->bits_next) ) <<
+				  ( 16 - lzms->bits ) );
+		}
+		lzms->bits += 16;
+	}
+}
+
+/**
+ * Get bits from bitstream
+ *
+ * @v lzms		Decompressor
+ * @v bits		Number of bits to fetch
+ * @ret value		Value
+ */
+static uint32_t lzms_getbits ( struct lzms *lzms, unsigned int bits ) {
+	uint32_t value = 0;
+	unsigned int chunk;
+
+	/* Fetch at most 16 bits at a time */
+	while ( bits ) {
+		chunk = ( ( bits > 16 ) ? ( bits - 16 ) : bits );
+		lzms_refill ( lzms );
+		value = ( ( value << chunk ) |
+			  ( ( lzms->accumulator >> 16 ) >> ( 16 - chunk ) ) );
+		lzms->accumulator <<= chunk;
+		lzms->bits -= chunk;
+		bits -= chunk;
+	}
+	return value;
+}
+
+/**
+ * Rebuild adaptive Huffman code
+ *
+ * @v lzms		Decompressor
+ * @v code		Adaptive Huffman code
+ *
+ * The code is constructed from the current symbol frequencies
+ * exactly as the compressor constructs it, including the tie-breaking
+ * rules and the method used to limit code lengths.
+ */
+static void lzms_rebuild ( struct lzms *lzms, struct lzms_code *code ) {
+	const uint32_t mask = ( ( 1U << LZMS_SYMBOL_BITS ) - 1 );
+	uint32_t *sorted = lzms->sorted;
+	unsigned int counts[ LZMS_MAX_CODE_BITS + 1 ];
+	unsigned int last = ( code->count - 1 );
+	unsigned int leaf;
+	unsigned int node;
+	unsigned int next;
+	unsigned int gap;
+	unsigned int len;
+	unsigned int i;
+	unsigned int j;
+	uint32_t value;
+	uint32_t freq;
+
+	/* Sort symbols by frequency, then by symbol value */
+	for ( i = 0 ; i <= last ; i++ )
+		sorted[i] = ( ( code->freq[i] << LZMS_SYMBOL_BITS ) | i );
+	for ( gap = ( code->count / 2 ) ; gap ; gap /= 2 ) {
+		for ( i = gap ; i <= last ; i++ ) {
+			value = sorted[i];
+			for ( j = i ; ( ( j >= gap ) &&
+					( sorted[ j - gap ] > value ) ) ;
+			      j -= gap ) {
+				sorted[j] = sorted[ j - gap ];
+			}
+			sorted[j] = value;
+		}
+	}
+
+	/* Construct Huffman tree in place.  Leaves are consumed in
+	 * order of increasing frequency (preferring leaves over
+	 * internal nodes of equal frequency), and each internal node
+	 * is written over a consumed leaf.  Each consumed internal
+	 * node has its frequency replaced by the index of its parent.
+	 */
+	leaf = node = next = 0;
+	do {
+		if ( ( ( leaf + 1 ) <= last ) &&
+		     ( ( node == next ) ||
+		       ( ( sorted[ leaf + 1 ] & ~mask ) <=
+			 ( sorted[node] & ~mask ) ) ) ) {
+			/* Two leaves */
+			freq = ( ( sorted[leaf] & ~mask ) +
+				 ( sorted[ leaf + 1 ] & ~mask ) );
+			leaf += 2;
+		} else if ( ( ( node + 2 ) <= next ) &&
+			    ( ( leaf > last ) ||
+			      ( ( sorted[ node + 1 ] & ~mask ) <
+				( sorted[leaf] & ~mask ) ) ) ) {
+			/* Two internal nodes */
+			freq = ( ( sorted[node] & ~mask ) +
+				 ( sorted[ node + 1 ] & ~mask ) );
+			sorted[node] = ( ( next << LZMS_SYMBOL_BITS ) |
+					 ( sorted[node] & mask ) );
+			node++;
+			sorted[node] = ( ( next << LZMS_SYMBOL_BITS ) |
+					 ( sorted[node] & mask ) );
+			node++;
+		} else {
+			/* One leaf and one internal node */
+			freq = ( ( sorted[leaf] & ~mask ) +
+				 ( sorted[node] & ~mask ) );
+			sorted[node] = ( ( next << LZMS_SYMBOL_BITS ) |
+					 ( sorted[node] & mask ) );
+			leaf++;
+			node++;
+		}
+		sorted[next] = ( freq | ( sorted[next] & mask ) );
+	} while ( ++next < last );
+
+	/* Count leaves at each depth, replacing each parent index
+	 * with the node's depth.  Any node that would be too deep is
+	 * instead attached at the deepest permissible leaf depth.
+	 */
+	memset ( counts, 0, sizeof ( counts ) );
+	counts[1] = 2;
+	sorted[ last - 1 ] &= mask;
+	for ( node = ( last - 1 ) ; node-- ; ) {
+		len = ( ( sorted[ sorted[node] >> LZMS_SYMBOL_BITS ] >>
+			  LZMS_SYMBOL_BITS ) + 1 );
+		sorted[node] = ( ( len << LZMS_SYMBOL_BITS ) |
+				 ( sorted[node] & mask ) );
+		if ( len >= LZMS_MAX_CODE_BITS ) {
+			len = LZMS_MAX_CODE_BITS;
+			while ( ! counts[ --len ] ) {}
+		}
+		counts[len]--;
+		counts[ len + 1 ] += 2;
+	}
+
+	/* Assign the longest lengths to the least frequent symbols */
+	for ( i = 0, len = LZMS_MAX_CODE_BITS ; len ; len-- ) {
+		for ( j = counts[len] ; j ; j-- )
+			code->lengths[ sorted[i++] & mask ] = len;
+	}
+
+	/* Construct Huffman alphabet.  This cannot fail, since the
+	 * constructed code is always complete.
+	 */
+	huffman_alphabet ( code->alphabet, code->lengths, code->count );
+
+	/* Decay frequencies */
+	for ( i = 0 ; i <= last ; i++ )
+		code->freq[i] = ( ( code->freq[i] >> 1 ) + 1 );
+	code->remaining = code->period;
+}
+
+/**
+ * Initialise adaptive Huffman code
+ *
+ * @v lzms		Decompressor
+ * @v code		Adaptive Huffman code
+ * @v alphabet		Huffman alphabet
+ * @v lengths		Code lengths
+ * @v freq		Symbol frequencies
+ * @v count		Number of symbols
+ * @v period		Number of symbols decoded between rebuilds
+ */
+static void lzms_code_init ( struct lzms *lzms, struct lzms_code *code,
+			     struct huffman_alphabet *alphabet,
+			     uint8_t *lengths, uint16_t *freq,
+			     unsigned int count, unsigned int period ) {
+	unsigned int i;
+
+	code->alphabet = alphabet;
+	code->lengths = lengths;
+	code->freq = freq;
+	code->count = count;
+	code->period = period;
+	for ( i = 0 ; i < count ; i++ )
+		freq[i] = 1;
+	lzms_rebuild ( lzms, code );
+}
+
+/**
+ * Decode adaptive Huffman-coded symbol
+ *
+ * @v lzms		Decompressor
+ * @v code		Adaptive Huffman code
+ * @ret raw		Raw symbol
+ */
+static unsigned int lzms_symbol ( struct lzms *lzms,
+				  struct lzms_code *code ) {
+	huffman_lookup_t entry;
+	unsigned int raw;
+
+	/* Decode symbol */
+	lzms_refill ( lzms );
+	entry = huffman_decode ( code->alphabet, ( lzms->accumulator >> 16 ) );
+	lzms->accumulator <<= huffman_len ( entry );
+	lzms->bits -= huffman_len ( entry );
+	raw = huffman_raw ( entry );
+
+	/* Update frequencies, rebuilding code if applicable */
+	code->freq[raw]++;
+	if ( ! --code->remaining )
+		lzms_rebuild ( lzms, code );
+
+	return raw;
+}
+
+/**
+ * Decode slot-coded value
+ *
+ * @v lzms		Decompressor
+ * @v code		Adaptive Huffman code
+ * @v base		Base value table
+ * @v bits		Extra bits table
+ * @ret value		Value
+ */
+static uint32_t lzms_value ( struct lzms *lzms, struct lzms_code *code,
+			     const uint32_t *base, const uint8_t *bits ) {
+	unsigned int slot;
+
+	slot = lzms_symbol ( lzms, code );
+	return ( base[slot] + lzms_getbits ( lzms, bits[slot] ) );
+}
+
+/**
+ * Initialise match source history
+ *
+ * @v history		Match source history
+ */
+static void lzms_history_init ( struct lzms_history *history ) {
+	unsigned int i;
+
+	lzms_decision_init ( &history->explicit, LZMS_MAX_STATES );
+	for ( i = 0 ; i < ( LZMS_REPEATS - 1 ) ; i++ )
+		lzms_decision_init ( &history->repeat[i], LZMS_MAX_STATES );
+	for ( i = 0 ; i < ( LZMS_REPEATS + 1 ) ; i++ )
+		history->recent[i] = ( i + 1 );
+	history->pending = 0;
+	history->pending_end = NULL;
+}
+
+/**
+ * Record recently used match source
+ *
+ * @v history		Match source history
+ * @v source		Match source
+ */
+static void lzms_remember ( struct lzms_history *history, uint64_t source ) {
+
+	memmove ( &history->recent[1], &history->recent[0],
+		  ( LZMS_REPEATS * sizeof ( history->recent[0] ) ) );
+	history->recent[0] = source;
+}
+
+/**
+ * Decode match source
+ *
+ * @v lzms		Decompressor
+ * @v history		Match source history
+ * @v out		Current output position
+ * @ret source		Match source
+ */
+static uint64_t lzms_source ( struct lzms *lzms, struct lzms_history *history,
+			      uint8_t *out ) {
+	uint64_t source;
+	unsigned int i;
+
+	/* Record pending source, unless this match immediately
+	 * follows the match that used it.
+	 */
+	if ( history->pending && ( out != history->pending_end ) ) {
+		lzms_remember ( history, history->pending );
+		history->pending = 0;
+	}
+
+	/* Decode source */
+	if ( ! lzms_bit ( lzms, &history->explicit ) ) {
+		source = 0;
+		if ( history == &lzms->delta ) {
+			source = lzms_symbol ( lzms, &lzms->power );
+			source <<= 32;
+		}
+		source |= lzms_value ( lzms, ( ( history == &lzms->delta ) ?
+					       &lzms->delta_offset :
+					       &lzms->lz_offset ),
+				       lzms_offset_base, lzms_offset_bits );
+	} else {
+		for ( i = 0 ; ( ( i < ( LZMS_REPEATS - 1 ) ) &&
+				lzms_bit ( lzms, &history->repeat[i] ) ) ; i++ ) {}
+		source = history->recent[i];
+		memmove ( &history->recent[i], &history->recent[ i + 1 ],
+			  ( ( LZMS_REPEATS - i ) *
+			    sizeof ( history->recent[0] ) ) );
+	}
+
+	/* Record any previous pending source, and hold this source
+	 * pending.
+	 */
+	if ( history->pending )
+		lzms_remember ( history, history->pending );
+	history->pending = source;
+
+	return source;
+}
+
+/**
+ * Undo x86 address translation
+ *
+ * @v data		Decompressed data
+ * @v len		Length of decompressed data
+ * @ret rc		Return status code
+ *
+ * The compressor converts relative addresses within likely x86
+ * instructions into absolute addresses.  Code is identified by
+ * repeated references to the same (truncated) target address within
+ * a limited window.
+ */
+static int lzms_x86 ( uint8_t *data, size_t len ) {
+	int32_t *targets;
+	int32_t closest = -( LZMS_X86_MAX_TRANSLATION + 1 );
+	int32_t offset;
+	int32_t limit;
+	uint32_t *operand;
+	unsigned int opcode_len;
+	uint16_t target;
+	uint8_t *opcode;
+	unsigned int i;
+
+	/* Do nothing unless there is at least one possible instruction */
+	if ( len <= ( LZMS_X86_TAIL + 1 ) )
+		return 0;
+
+	/* Allocate jump target table, if not already allocated */
+	if ( ! lzms_x86_targets ) {
+		lzms_x86_targets = malloc ( LZMS_X86_TARGETS *
+					    sizeof ( lzms_x86_targets[0] ) );
+		if ( ! lzms_x86_targets ) {
+			DBG ( "Could not allocate LZMS x86 target table\n" );
+			return -1;
+		}
+	}
+	targets = lzms_x86_targets;
+	for ( i = 0 ; i < LZMS_X86_TARGETS ; i++ )
+		targets[i] = -( LZMS_X86_ID_WINDOW + 1 );
+
+	/* Scan for instructions */
+	for ( offset = 1 ; ( ( size_t ) ( offset + LZMS_X86_TAIL ) ) < len ; ) {
+
+		/* Identify instructions using relative addressing */
+		opcode = &data[offset];
+		opcode_len = 0;
+		limit = LZMS_X86_MAX_TRANSLATION;
+		switch ( opcode[0] ) {
+		case 0x48:
+			/* RIP-relative MOV or LEA */
+			if ( ( ( opcode[1] == 0x8b ) &&
+			       ( ( opcode[2] == 0x05 ) ||
+				 ( opcode[2] == 0x0d ) ) ) ||
+			     ( ( opcode[1] == 0x8d ) &&
+			       ( ( opcode[2] & 0x07 ) == 0x05 ) ) )
+				opcode_len = 3;
+			break;
+		case 0x4c:
+			/* RIP-relative LEA */
+			if ( ( opcode[1] == 0x8d ) &&
+			     ( ( opcode[2] & 0x07 ) == 0x05 ) )
+				opcode_len = 3;
+			break;
+		case 0xe8:
+			/* Relative CALL (requiring greater confidence) */
+			opcode_len = 1;
+			limit /= 2;
+			break;
+		case 0xe9:
+			/* Relative JMP (never translated) */
+			offset += 4;
+			break;
+		case 0xf0:
+			/* RIP-relative LOCK ADD */
+			if ( ( opcode[1] == 0x83 ) && ( opcode[2] == 0x05 ) )
+				opcode_len = 3;
+			break;
+		case 0xff:
+			/* RIP-relative indirect CALL */
+			if ( opcode[1] == 0x15 )
+				opcode_len = 2;
+			break;
+		}
+		if ( ! opcode_len ) {
+			offset++;
+			continue;
+		}
+
+		/* Translate operand if within likely x86 code */
+		operand = ( ( uint32_t * ) ( opcode + opcode_len ) );
+		if ( ( offset - closest ) <= limit )
+			*operand -= offset;
+
+		/* Identify likely x86 code via repeated targets */
+		target = ( offset + *operand );
+		offset += ( opcode_len + sizeof ( *operand ) - 1 );
+		if ( ( offset - targets[target] ) <= LZMS_X86_ID_WINDOW )
+			closest = offset;
+		targets[target] = offset;
+		offset++;
+	}
+
+	return 0;
+}
+
+/**
+ * Decompress LZMS-compressed data
+ *
+ * @v data		Compressed data
+ * @v len		Length of compressed data
+ * @v buf		Decompression buffer
+ * @v max_len		Length of decompressed data
+ * @ret out_len		Length of decompressed data, or negative error
+ *
+ * LZMS-compressed data does not record its own length, and so the
+ * length of the decompressed data must be known in advance.
+ */
+ssize_t lzms_decompress ( const void *data, size_t len, void *buf,
+			  size_t max_len ) {
+	static struct lzms lzms; /* Too large to comfortably fit on the stack */
+	struct lzms_history *history;
+	const uint16_t *data16 = data;
+	uint8_t *out = buf;
+	uint8_t *end = ( buf + max_len );
+	unsigned int slots;
+	uint64_t source;
+	uint32_t offset;
+	uint32_t span;
+	size_t match_len;
+	int rc;
+
+	/* Sanity check */
+	if ( ( len & 1 ) || ( len < ( 2 * sizeof ( data16[0] ) ) ) ) {
+		DBG ( "LZMS compressed data has invalid length %#zx\n", len );
+		return -1;
+	}
+
+	/* Construct slot tables, if not already done */
+	if ( ! lzms_offset_base[LZMS_OFFSET_SLOTS] ) {
+		lzms_slots ( lzms_offset_base, lzms_offset_bits,
+			     LZMS_OFFSET_SLOTS, lzms_offset_runs, 0x7fffffffUL );
+		lzms_slots ( lzms_length_base, lzms_length_bits,
+			     LZMS_LENGTH_SLOTS, lzms_length_runs, 0x400108abUL );
+	}
+
+	/* Initialise range decoder and bitstream */
+	lzms.range = 0xffffffffUL;
+	lzms.code = ( ( ( ( uint32_t ) data16[0] ) << 16 ) | data16[1] );
+	lzms.range_next = &data16[2];
+	lzms.range_end = lzms.bits_next = &data16[ len / sizeof ( data16[0] ) ];
+	lzms.bits_start = data16;
+	lzms.accumulator = 0;
+	lzms.bits = 0;
+
+	/* Initialise decisions */
+	lzms_decision_init ( &lzms.main, 16 );
+	lzms_decision_init ( &lzms.match, 32 );
+	lzms_history_init ( &lzms.lz );
+	lzms_history_init ( &lzms.delta );
+
+	/* Initialise codes, using only as many offset slots as could
+	 * possibly be required.
+	 */
+	for ( slots = 2 ; ( ( slots < LZMS_OFFSET_SLOTS ) &&
+			    ( lzms_offset_base[slots] < max_len ) ) ; slots++ ) {}
+	lzms_code_init ( &lzms, &lzms.literal, &lzms.literal_alphabet,
+			 lzms.literal_lengths, lzms.literal_freq,
+			 LZMS_LITERAL_CODES, LZMS_LITERAL_PERIOD );
+	lzms_code_init ( &lzms, &lzms.lz_offset, &lzms.lz_offset_alphabet,
+			 lzms.lz_offset_lengths, lzms.lz_offset_freq,
+			 slots, LZMS_OFFSET_PERIOD );
+	lzms_code_init ( &lzms, &lzms.length, &lzms.length_alphabet,
+			 lzms.length_lengths, lzms.length_freq,
+			 LZMS_LENGTH_SLOTS, LZMS_LENGTH_PERIOD );
+	lzms_code_init ( &lzms, &lzms.delta_offset,
+			 &lzms.delta_offset_alphabet,
+			 lzms.delta_offset_lengths, lzms.delta_offset_freq,
+			 slots, LZMS_OFFSET_PERIOD );
+	lzms_code_init ( &lzms, &lzms.power, &lzms.power_alphabet,
+			 lzms.power_lengths, lzms.power_freq,
+			 LZMS_POWER_CODES, LZMS_POWER_PERIOD );
+
+	/* Decompress data */
+	while ( out < end ) {
+
+		/* Decode literal */
+		if ( ! lzms_bit ( &lzms, &lzms.main ) ) {
+			*(out++) = lzms_symbol ( &lzms, &lzms.literal );
+			continue;
+		}
+
+		/* Decode match source and length */
+		history = ( lzms_bit ( &lzms, &lzms.match ) ?
+			    &lzms.delta : &lzms.lz );
+		source = lzms_source ( &lzms, history, out );
+		match_len = lzms_value ( &lzms, &lzms.length, lzms_length_base,
+					 lzms_length_bits );
+		if ( match_len > ( ( size_t ) ( end - out ) ) ) {
+			DBG ( "LZMS match overrun at %#zx (length %#zx)\n",
+			      ( ( size_t ) ( out - ( uint8_t * ) buf ) ),
+			      match_len );
+			return -1;
+		}
+
+		/* Copy LZ match */
+		if ( history == &lzms.lz ) {
+			offset = source;
+			if ( offset > ( ( size_t ) ( out - ( uint8_t * ) buf ) ) ) {
+				DBG ( "LZMS match underrun at %#zx (offset "
+				      "%#x)\n", ( ( size_t ) ( out -
+						( uint8_t * ) buf ) ), offset );
+				return -1;
+			}
+			out = lz77_copy ( out, offset, match_len );
+			history->pending_end = out;
+			continue;
+		}
+
+		/* Construct delta match.  Each byte is predicted from
+		 * the bytes one span before, a scaled offset before,
+		 * and both.
+		 */
+		span = ( 1UL << ( source >> 32 ) );
+		offset = ( ( ( uint32_t ) source ) << ( source >> 32 ) );
+		if ( ( ( offset >> ( source >> 32 ) ) != ( ( uint32_t ) source ) ) ||
+		     ( ( offset + span ) < offset ) ||
+		     ( ( offset + span ) >
+		       ( ( size_t ) ( out - ( uint8_t * ) buf ) ) ) ) {
+			DBG ( "LZMS delta match underrun at %#zx (power %d "
+			      "offset %#x)\n",
+			      ( ( size_t ) ( out - ( uint8_t * ) buf ) ),
+			      ( ( int ) ( source >> 32 ) ),
+			      ( ( uint32_t ) source ) );
+			return -1;
+		}
+		for ( ; match_len ; match_len--, out++ ) {
+			*out = ( *( out - span ) + *( out - offset ) -
+				 *( out - span - offset ) );
+		}
+		history->pending_end = out;
+	}
+
+	/* Undo x86 address translation */
+	if ( ( rc = lzms_x86 ( buf, max_len ) ) != 0 )
+		return rc;
+
+	return max_len;
+}
@@ -0,0 +1,252 @@
+#ifndef _LZMS_H
+#define _LZMS_H
+
+/*
+ * Copyright (C) 2026 Michael Brown <mbrown@fensystems.co.uk>.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * @file
+ *
+ * LZMS decompression
+ *
+ */
+
+#include <stdint.h>
+#include "huffman.h"
+
+/** Number of literal codes */
+#define LZMS_LITERAL_CODES 256
+
+/** Maximum number of offset slots */
+#define LZMS_OFFSET_SLOTS 799
+
+/** Number of length slots */
+#define LZMS_LENGTH_SLOTS 54
+
+/** Number of delta power codes */
+#define LZMS_POWER_CODES 8
+
+/** Maximum Huffman code length (in bits) */
+#define LZMS_MAX_CODE_BITS 15
+
+/** Number of bits used to hold a symbol during Huffman code construction */
+#define LZMS_SYMBOL_BITS 10
+
+/** Literal code rebuild period */
+#define LZMS_LITERAL_PERIOD 1024
+
+/** Offset code rebuild period */
+#define LZMS_OFFSET_PERIOD 1024
+
+/** Length code rebuild period */
+#define LZMS_LENGTH_PERIOD 512
+
+/** Delta power code rebuild period */
+#define LZMS_POWER_PERIOD 512
+
+/** Number of repeated match sources */
+#define LZMS_REPEATS 3
+
+/** Maximum number of states for any decision */
+#define LZMS_MAX_STATES 64
+
+/** Probability precision (in bits) */
+#define LZMS_PROBABILITY_BITS 6
+
+/** Initial number of zero bits within a probability's recent history */
+#define LZMS_INITIAL_ZEROS 48
+
+/** Initial recent history for a probability */
+#define LZMS_INITIAL_RECENT 0x0000000055555555ULL
+
+/** Number of tracked x86 jump targets */
+#define LZMS_X86_TARGETS 65536
+
+/** Window within which repeated x86 jump targets identify x86 code */
+#define LZMS_X86_ID_WINDOW 65535
+
+/** Maximum distance from identified x86 code for translation */
+#define LZMS_X86_MAX_TRANSLATION 1023
+
+/** Number of trailing output bytes never subject to x86 translation */
+#define LZMS_X86_TAIL 16
+
+/** An LZMS adaptive probability */
+struct lzms_probability {
+	/** Number of zero bits within recent history */
+	unsigned int zeros;
+	/** Recent history (most recent bit in the least significant bit) */
+	uint64_t recent;
+};
+
+/** An LZMS range-coded binary decision */
+struct lzms_decision {
+	/** Current state (derived from previous decisions) */
+	unsigned int state;
+	/** Number of states */
+	unsigned int states;
+	/** Probabilities, indexed by state */
+	struct lzms_probability probability[LZMS_MAX_STATES];
+};
+
+/** An LZMS adaptive Huffman code */
+struct lzms_code {
+	/** Huffman alphabet (followed by the raw symbols) */
+	struct huffman_alphabet *alphabet;
+	/** Code lengths */
+	uint8_t *lengths;
+	/** Symbol frequencies */
+	uint16_t *freq;
+	/** Number of symbols */
+	unsigned int count;
+	/** Number of symbols decoded between rebuilds */
+	unsigned int period;
+	/** Number of symbols remaining until next rebuild */
+	unsigned int remaining;
+};
+
+/** An LZMS match source history
+ *
+ * Each source is an LZ offset, or a delta offset combined with a
+ * power in the upper 32 bits.  A newly used source is held pending
+ * until the next match of the same type, and is skipped over (rather
+ * than being available for repetition) if that match immediately
+ * follows.
+ */
+struct lzms_history {
+	/** Explicit source decision */
+	struct lzms_decision explicit;
+	/** Repeated source decisions */
+	struct lzms_decision repeat[ LZMS_REPEATS - 1 ];
+	/** Recently used sources (with one spare entry) */
+	uint64_t recent[ LZMS_REPEATS + 1 ];
+	/** Pending source, or zero */
+	uint64_t pending;
+	/** End of match that used the pending source */
+	uint8_t *pending_end;
+};
+
+/** LZMS decompressor */
+struct lzms {
+	/** Next range decoder input word */
+	const uint16_t *range_next;
+	/** End of range decoder input */
+	const uint16_t *range_end;
+	/** Range */
+	uint32_t range;
+	/** Code value */
+	uint32_t code;
+
+	/** Next (i.e. preceding) bitstream input word */
+	const uint16_t *bits_next;
+	/** Start of bitstream input */
+	const uint16_t *bits_start;
+	/** Bit accumulator */
+	uint32_t accumulator;
+	/** Number of bits in accumulator */
+	unsigned int bits;
+
+	/** Main (literal or match) decision */
+	struct lzms_decision main;
+	/** Match type (LZ or delta) decision */
+	struct lzms_decision match;
+	/** LZ match source history */
+	struct lzms_history lz;
+	/** Delta match source history */
+	struct lzms_history delta;
+
+	/** Literal code */
+	struct lzms_code literal;
+	/** LZ offset code */
+	struct lzms_code lz_offset;
+	/** Length code */
+	struct lzms_code length;
+	/** Delta offset code */
+	struct lzms_code delta_offset;
+	/** Delta power code */
+	struct lzms_code power;
+
+	/** Literal Huffman alphabet */
+	struct huffman_alphabet literal_alphabet;
+	/** Literal raw symbols
+	 *
+	 * Must immediately follow the literal Huffman alphabet.
+	 */
+	huffman_raw_symbol_t literal_raw[LZMS_LITERAL_CODES];
+	/** Literal code lengths */
+	uint8_t literal_lengths[LZMS_LITERAL_CODES];
+	/** Literal frequencies */
+	uint16_t literal_freq[LZMS_LITERAL_CODES];
+
+	/** LZ offset Huffman alphabet */
+	struct huffman_alphabet lz_offset_alphabet;
+	/** LZ offset raw symbols
+	 *
+	 * Must immediately follow the LZ offset Huffman alphabet.
+	 */
+	huffman_raw_symbol_t lz_offset_raw[LZMS_OFFSET_SLOTS];
+	/** LZ offset code lengths */
+	uint8_t lz_offset_lengths[LZMS_OFFSET_SLOTS];
+	/** LZ offset frequencies */
+	uint16_t lz_offset_freq[LZMS_OFFSET_SLOTS];
+
+	/** Length Huffman alphabet */
+	struct huffman_alphabet length_alphabet;
+	/** Length raw symbols
+	 *
+	 * Must immediately follow the length Huffman alphabet.
+	 */
+	huffman_raw_symbol_t length_raw[LZMS_LENGTH_SLOTS];
+	/** Length code lengths */
+	uint8_t length_lengths[LZMS_LENGTH_SLOTS];
+	/** Length frequencies */
+	uint16_t length_freq[LZMS_LENGTH_SLOTS];
+
+	/** Delta offset Huffman alphabet */
+	struct huffman_alphabet delta_offset_alphabet;
+	/** Delta offset raw symbols
+	 *
+	 * Must immediately follow the delta offset Huffman alphabet.
+	 */
+	huffman_raw_symbol_t delta_offset_raw[LZMS_OFFSET_SLOTS];
+	/** Delta offset code lengths */
+	uint8_t delta_offset_lengths[LZMS_OFFSET_SLOTS];
+	/** Delta offset frequencies */
+	uint16_t delta_offset_freq[LZMS_OFFSET_SLOTS];
+
+	/** Delta power Huffman alphabet */
+	struct huffman_alphabet power_alphabet;
+	/** Delta power raw symbols
+	 *
+	 * Must immediately follow the delta power Huffman alphabet.
+	 */
+	huffman_raw_symbol_t power_raw[LZMS_POWER_CODES];
+	/** Delta power code lengths */
+	uint8_t power_lengths[LZMS_POWER_CODES];
+	/** Delta power frequencies */
+	uint16_t power_freq[LZMS_POWER_CODES];
+
+	/** Huffman code construction workspace */
+	uint32_t sorted[LZMS_OFFSET_SLOTS];
+};
+
+extern ssize_t lzms_decompress ( const void *data, size_t len, void *buf,
+				 size_t max_len );
+
+#endif /* _LZMS_H */
@@ -29,6 +29,7 @@
 #include <string.h>
 #include <stdio.h>
 #include "wimboot.h"
+#include "lz77.h"
 #include "lznt1.h"
 
 /**
@@ -38,13 +39,15 @@
  * @v limit		Length of compressed data up to end of block
  * @v offset		Starting offset within compressed data
  * @v block		Decompression buffer for this block, or NULL
+ * @v max_len		Length of decompression buffer (if present)
  * @ret out_len		Length of decompressed block, or negative error
  */
 static ssize_t lznt1_block ( const void *data, size_t limit, size_t offset,
-			     void *block ) {
+			     void *block, size_t max_len ) {
 	const uint16_t *tuple;
 	const uint8_t *copy_src;
 	uint8_t *copy_dest = block;
+	size_t copy_offset;
 	size_t copy_len;
 	size_t block_out_len = 0;
 	unsigned int split = 12;
@@ -74,21 +77,36 @@ static ssize_t lznt1_block ( const void *data, size_t limit, size_t offset,
 			tuple = ( data + offset );
 			offset += sizeof ( *tuple );
 			copy_len = LZNT1_VALUE_LEN ( *tuple, split );
+			copy_offset = LZNT1_VALUE_OFFSET ( *tuple, split );
+			if ( copy_offset > block_out_len ) {
+				DBG ( "LZNT1 compressed value underrun at "
+				      "%#zx\n", offset );
+				return -1;
+			}
+			if ( copy_dest &&
+			     ( copy_len > ( max_len - block_out_len ) ) ) {
+				DBG ( "LZNT1 output overrun at %#zx\n",
+				      offset );
+				return -1;
+			}
 			block_out_len += copy_len;
 			if ( copy_dest ) {
-				copy_src = ( copy_dest -
-					     LZNT1_VALUE_OFFSET ( *tuple,
-								  split ) );
-				while ( copy_len-- )
-					*(copy_dest++) = *(copy_src++);
+				copy_dest = lz77_copy ( copy_dest, copy_offset,
+							copy_len );
 			}
 
 		} else {
 
 			/* Uncompressed value */
 			copy_src = ( data + offset );
-			if ( copy_dest )
+			if ( copy_dest ) {
+				if ( block_out_len >= max_len ) {
+					DBG ( "LZNT1 output overrun at %#zx\n",
+					      offset );
+					return -1;
+				}
 				*(copy_dest++) = *copy_src;
+			}
 			offset++;
 			block_out_len++;
 		}
@@ -113,9 +131,11 @@ static ssize_t lznt1_block ( const void *data, size_t limit, size_t offset,
  * @v data		Compressed data
  * @v len		Length of compressed data
  * @v buf		Decompression buffer, or NULL
+ * @v max_len		Length of decompression buffer (if present)
  * @ret out_len		Length of decompressed data, or negative error
  */
-ssize_t lznt1_decompress ( const void *data, size_t len, void *buf ) {
+ssize_t lznt1_decompress ( const void *data, size_t len, void *buf,
+			   size_t max_len ) {
 	const uint16_t *header;
 	const uint8_t *end;
 	size_t offset = 0;
@@ -144,6 +164,11 @@ ssize_t lznt1_decompress ( const void *data, size_t len, void *buf ) {
 
 		/* Process block */
 		block_len = LZNT1_BLOCK_LEN ( *header );
+		if ( ( offset + block_len ) > len ) {
+			DBG ( "LZNT1 block overrun at %#zx+%#zx\n",
+			      offset, block_len );
+			return -1;
+		}
 		if ( LZNT1_BLOCK_COMPRESSED ( *header ) ) {
 
 			/* Compressed block */
@@ -152,7 +177,8 @@ ssize_t lznt1_decompress ( const void *data, size_t len, void *buf ) {
 			limit = ( offset + block_len );
 			block = ( buf ? ( buf + out_len ) : NULL );
 			block_out_len = lznt1_block ( data, limit, offset,
-						      block );
+						      block,
+						      ( max_len - out_len ) );
 			if ( block_out_len < 0 )
 				return block_out_len;
 			offset += block_len;
@@ -161,13 +187,14 @@ ssize_t lznt1_decompress ( const void *data, size_t len, void *buf ) {
 		} else {
 
 			/* Uncompressed block */
-			if ( ( offset + block_len ) > len ) {
-				DBG ( "LZNT1 uncompressed block overrun at "
-				      "%#zx+%#zx\n", offset, block_len );
-				return -1;
-			}
 			DBG2 ( "LZNT1 uncompressed block %#zx+%#zx\n",
 			       offset, block_len );
+			if ( buf &&
+			     ( block_len > ( max_len - ( size_t ) out_len ) ) ) {
+				DBG ( "LZNT1 output overrun at %#zx+%#zx\n",
+				      offset, block_len );
+				return -1;
+			}
 			if ( buf ) {
 				memcpy ( ( buf + out_len ), ( data + offset ),
 					 block_len );
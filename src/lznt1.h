@@ -42,6 +42,7 @@
 /** Extract LZNT1 compressed value offset */
 #define LZNT1_VALUE_OFFSET( tuple, split ) ( ( (tuple) >> split ) + 1 )
 
-extern ssize_t lznt1_decompress ( const void *data, size_t len, void *buf );
+extern ssize_t lznt1_decompress ( const void *data, size_t len, void *buf,
+				  size_t max_len );
 
 #endif /* _LZNT1_H */
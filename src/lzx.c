@@ -37,11 +37,52 @@
 #include <stdio.h>
 #include "wimboot.h"
 #include "huffman.h"
+#include "lz77.h"
 #include "lzx.h"
 
 /** Base positions, indexed by position slot */
 static unsigned int lzx_position_base[LZX_POSITION_SLOTS];
 
+/**
+ * Refill LZX bit accumulator
+ *
+ * @v lzx		Decompressor
+ */
+static inline __attribute__ (( always_inline )) void
+lzx_refill ( struct lzx *lzx ) {
+	const uint16_t *src16;
+
+	/* Fetch as many input words as will fit in the accumulator */
+	src16 = ( ( void * ) lzx->input.data + lzx->input.offset );
+	if ( likely ( ( lzx->input.len - lzx->input.offset ) >=
+		      sizeof ( lzx->accumulator ) ) ) {
+
+		/* Fast path: accumulator can be filled without
+		 * checking for the end of the input data.
+		 */
+		do {
+			lzx->accumulator |=
+				( ( ( lzx_accumulator_t ) *(src16++) ) <<
+				  ( LZX_ACCUMULATOR_BITS - 16 - lzx->bits ) );
+			lzx->bits += 16;
+		} while ( lzx->bits <= ( LZX_ACCUMULATOR_BITS - 16 ) );
+
+	} else {
+
+		/* Slow path: near the end of the input data */
+		while ( ( lzx->bits <= ( LZX_ACCUMULATOR_BITS - 16 ) ) &&
+			( ( ( void * ) src16 ) <
+			  ( ( void * ) lzx->input.data + lzx->input.len ) ) ) {
+			lzx->accumulator |=
+				( ( ( lzx_accumulator_t ) *(src16++) ) <<
+				  ( LZX_ACCUMULATOR_BITS - 16 - lzx->bits ) );
+			lzx->bits += 16;
+		}
+	}
+	lzx->input.offset = ( ( ( void * ) src16 ) -
+			      ( ( void * ) lzx->input.data ) );
+}
+
 /**
  * Attempt to accumulate bits from LZX bitstream
  *
@@ -53,19 +94,14 @@ static unsigned int lzx_position_base[LZX_POSITION_SLOTS];
  * bitstream; callers must check that sufficient bits are available
  * before using the value.
  */
-static int lzx_accumulate ( struct lzx *lzx, unsigned int bits ) {
-	const uint16_t *src16;
+static inline __attribute__ (( always_inline )) unsigned int
+lzx_accumulate ( struct lzx *lzx, unsigned int bits ) {
 
 	/* Accumulate more bits if required */
-	if ( ( lzx->bits < bits ) &&
-	     ( lzx->input.offset < lzx->input.len ) ) {
-		src16 = ( ( void * ) lzx->input.data + lzx->input.offset );
-		lzx->input.offset += sizeof ( *src16 );
-		lzx->accumulator |= ( *src16 << ( 16 - lzx->bits ) );
-		lzx->bits += 16;
-	}
+	if ( unlikely ( lzx->bits < bits ) )
+		lzx_refill ( lzx );
 
-	return ( lzx->accumulator >> 16 );
+	return ( lzx->accumulator >> ( LZX_ACCUMULATOR_BITS - 16 ) );
 }
 
 /**
@@ -75,10 +111,11 @@ static int lzx_accumulate ( struct lzx *lzx, unsigned int bits ) {
  * @v bits		Number of bits to consume
  * @ret rc		Return status code
  */
-static int lzx_consume ( struct lzx *lzx, unsigned int bits ) {
+static inline __attribute__ (( always_inline )) int
+lzx_consume ( struct lzx *lzx, unsigned int bits ) {
 
 	/* Fail if insufficient bits are available */
-	if ( lzx->bits < bits ) {
+	if ( unlikely ( lzx->bits < bits ) ) {
 		DBG ( "LZX input overrun in %#zx/%#zx out %#zx)\n",
 		      lzx->input.offset, lzx->input.len, lzx->output.offset );
 		return -1;
@@ -99,7 +136,7 @@ static int lzx_consume ( struct lzx *lzx, unsigned int bits ) {
  * @ret value		Value, or negative error
  */
 static int lzx_getbits ( struct lzx *lzx, unsigned int bits ) {
-	int norm_value;
+	unsigned int norm_value;
 	int rc;
 
 	/* Accumulate more bits if required */
@@ -109,6 +146,11 @@ static int lzx_getbits ( struct lzx *lzx, unsigned int bits ) {
 	if ( ( rc = lzx_consume ( lzx, bits ) ) != 0 )
 		return rc;
 
+	/* Track bits held by a minimal accumulator */
+	if ( lzx->held < bits )
+		lzx->held += 16;
+	lzx->held -= bits;
+
 	return ( norm_value >> ( 16 - bits ) );
 }
 
@@ -121,14 +163,22 @@ static int lzx_getbits ( struct lzx *lzx, unsigned int bits ) {
  */
 static int lzx_align ( struct lzx *lzx, unsigned int bits ) {
 	int pad;
+	int rc;
 
 	/* Get padding bits */
 	pad = lzx_getbits ( lzx, bits );
 	if ( pad < 0 )
 		return pad;
 
-	/* Consume all accumulated bits */
-	lzx_consume ( lzx, lzx->bits );
+	/* Consume all bits held by a minimal accumulator */
+	if ( ( rc = lzx_consume ( lzx, lzx->held ) ) != 0 )
+		return rc;
+
+	/* Return any remaining (whole) words to the input stream */
+	lzx->input.offset -= ( lzx->bits / 8 );
+	lzx->accumulator = 0;
+	lzx->bits = 0;
+	lzx->held = 0;
 
 	return 0;
 }
@@ -165,24 +215,26 @@ static int lzx_getbytes ( struct lzx *lzx, void *data, size_t len ) {
  * @v alphabet		Huffman alphabet
  * @ret raw		Raw symbol, or negative error
  */
-static int lzx_decode ( struct lzx *lzx, struct huffman_alphabet *alphabet ) {
-	struct huffman_symbols *sym;
-	int huf;
+static inline __attribute__ (( always_inline )) int
+lzx_decode ( struct lzx *lzx, struct huffman_alphabet *alphabet ) {
+	huffman_lookup_t entry;
+	unsigned int huf;
 	int rc;
 
 	/* Accumulate sufficient bits */
 	huf = lzx_accumulate ( lzx, HUFFMAN_BITS );
-	if ( huf < 0 )
-		return huf;
 
 	/* Decode symbol */
-	sym = huffman_sym ( alphabet, huf );
+	entry = huffman_decode ( alphabet, huf );
 
 	/* Consume bits */
-	if ( ( rc = lzx_consume ( lzx, huffman_len ( sym ) ) ) != 0 )
+	if ( ( rc = lzx_consume ( lzx, huffman_len ( entry ) ) ) != 0 )
 		return rc;
 
-	return huffman_raw ( sym, huf );
+	/* Track bits held by a minimal accumulator */
+	lzx->held = ( ( lzx->held & 15 ) + 16 - huffman_len ( entry ) );
+
+	return huffman_raw ( entry );
 }
 
 /**
@@ -279,6 +331,11 @@ static int lzx_pretree ( struct lzx *lzx, unsigned int count,
 				code = lzx_decode ( lzx, &lzx->pretree );
 				if ( code < 0 )
 					return code;
+				if ( code > 16 ) {
+					DBG ( "Invalid pretree run code %d\n",
+					      code );
+					return -1;
+				}
 				length = ( ( lengths[i] - code + 17 ) % 17 );
 			} else {
 				DBG ( "Unrecognised pretree code %d\n", code );
@@ -333,7 +390,8 @@ static int lzx_main_alphabet ( struct lzx *lzx ) {
 	}
 
 	/* Generate remaining symbols pretree */
-	if ( ( rc = lzx_pretree ( lzx, ( LZX_MAIN_CODES - LZX_MAIN_LIT_CODES ),
+	if ( ( rc = lzx_pretree ( lzx,
+				  ( lzx->main_codes - LZX_MAIN_LIT_CODES ),
 				  lzx->main_lengths.remainder ) ) != 0 ) {
 		DBG ( "Could not construct main remainder pretree\n" );
 		return rc;
@@ -341,7 +399,7 @@ static int lzx_main_alphabet ( struct lzx *lzx ) {
 
 	/* Generate Huffman alphabet */
 	if ( ( rc = huffman_alphabet ( &lzx->main, lzx->main_lengths.literals,
-				       LZX_MAIN_CODES ) ) != 0 ) {
+				       lzx->main_codes ) ) != 0 ) {
 		DBG ( "Could not generate main alphabet\n" );
 		return rc;
 	}
@@ -385,6 +443,7 @@ static int lzx_block_header ( struct lzx *lzx ) {
 	size_t block_len;
 	int block_type;
 	int default_len;
+	int len_top;
 	int len_high;
 	int len_low;
 	int rc;
@@ -402,15 +461,27 @@ static int lzx_block_header ( struct lzx *lzx ) {
 	if ( default_len ) {
 		block_len = LZX_DEFAULT_BLOCK_LEN;
 	} else {
+		len_top = 0;
+		if ( lzx->window >= LZX_WIDE_BLOCK_WINDOW ) {
+			len_top = lzx_getbits ( lzx, 8 );
+			if ( len_top < 0 )
+				return len_top;
+		}
 		len_high = lzx_getbits ( lzx, 8 );
 		if ( len_high < 0 )
 			return len_high;
 		len_low = lzx_getbits ( lzx, 8 );
 		if ( len_low < 0 )
 			return len_low;
-		block_len = ( ( len_high << 8 ) | len_low );
+		block_len = ( ( len_top << 16 ) | ( len_high << 8 ) | len_low );
 	}
 	lzx->output.threshold = ( lzx->output.offset + block_len );
+	if ( lzx->output.threshold > lzx->output.len ) {
+		DBG ( "LZX output overrun in %#zx/%#zx out %#zx block %#zx\n",
+		      lzx->input.offset, lzx->input.len, lzx->output.offset,
+		      block_len );
+		return -1;
+	}
 
 	/* Handle block type */
 	switch ( block_type ) {
@@ -456,11 +527,11 @@ static int lzx_uncompressed ( struct lzx *lzx ) {
 	int rc;
 
 	/* Copy bytes */
-	data = ( lzx->output.data ?
-		 ( lzx->output.data + lzx->output.offset ) : NULL );
+	data = ( lzx->output.data + lzx->output.offset );
 	len = ( lzx->output.threshold - lzx->output.offset );
 	if ( ( rc = lzx_getbytes ( lzx, data, len ) ) != 0 )
 		return rc;
+	lzx->output.offset += len;
 
 	/* Align input stream */
 	if ( len % 2 )
@@ -470,15 +541,22 @@ static int lzx_uncompressed ( struct lzx *lzx ) {
 }
 
 /**
- * Process an LZX token
+ * Process LZX token stream
  *
  * @v lzx		Decompressor
+ * @v alignoffset	Block is an aligned offset block
+ * @v limit		Output offset at which to stop
  * @ret rc		Return status code
  *
+ * This is always inlined with a constant block type, so that each
+ * block type gets its own token loop without any per-token test of
+ * the block type.
+ *
  * Variable names are chosen to match the LZX specification
  * pseudo-code.
  */
-static int lzx_token ( struct lzx *lzx ) {
+static inline __attribute__ (( always_inline )) int
+lzx_tokens ( struct lzx *lzx, int alignoffset, size_t limit ) {
 	unsigned int length_header;
 	unsigned int position_slot;
 	unsigned int offset_bits;
@@ -489,108 +567,234 @@ static int lzx_token ( struct lzx *lzx ) {
 	int aligned_bits;
 	int main;
 	int length;
-	uint8_t *copy;
-
-	/* Get main symelse*/
-	main = lzx_decode ( lzx, &lzx->main );
-	if ( main < 0 )
-		return main;
-
-	/* Check for literals */
-	if ( main < LZX_MAIN_LIT_CODES ) {
-		if ( lzx->output.data )
-			lzx->output.data[lzx->output.offset] = main;
-		lzx->output.offset++;
-		return 0;
-	}
-	main -= LZX_MAIN_LIT_CODES;
-
-	/* Calculate the match length */
-	length_header = ( main & 7 );
-	if ( length_header == 7 ) {
-		length = lzx_decode ( lzx, &lzx->length );
-		if ( length < 0 )
-			return length;
-	} else {
-		length = 0;
-	}
-	match_length = ( length_header + 2 + length );
 
-	/* Calculate the position slot */
-	position_slot = ( main >> 3 );
-	if ( position_slot < LZX_REPEATED_OFFSETS ) {
+	while ( lzx->output.offset < limit ) {
 
-		/* Repeated offset */
-		match_offset = lzx->repeated_offset[position_slot];
-		lzx->repeated_offset[position_slot] = lzx->repeated_offset[0];
-		lzx->repeated_offset[0] = match_offset;
+		/* Get main symbol */
+		main = lzx_decode ( lzx, &lzx->main );
+		if ( main < 0 )
+			return main;
 
-	} else {
+		/* Check for literals */
+		if ( main < LZX_MAIN_LIT_CODES ) {
+			lzx->output.data[lzx->output.offset++] = main;
+			continue;
+		}
+		main -= LZX_MAIN_LIT_CODES;
+
+		/* Calculate the match length */
+		length_header = ( main & 7 );
+		if ( length_header == 7 ) {
+			length = lzx_decode ( lzx, &lzx->length );
+			if ( length < 0 )
+				return length;
+		} else {
+			length = 0;
+		}
+		match_length = ( length_header + 2 + length );
+
+		/* Calculate the position slot */
+		position_slot = ( main >> 3 );
+		if ( position_slot < LZX_REPEATED_OFFSETS ) {
+
+			/* Repeated offset */
+			match_offset = lzx->repeated_offset[position_slot];
+			lzx->repeated_offset[position_slot] =
+				lzx->repeated_offset[0];
+			lzx->repeated_offset[0] = match_offset;
 
-		/* Non-repeated offset */
-		offset_bits = lzx_footer_bits ( position_slot );
-		if ( ( lzx->block_type == LZX_BLOCK_ALIGNOFFSET ) &&
-		     ( offset_bits >= 3 ) ) {
-			verbatim_bits = lzx_getbits ( lzx, ( offset_bits - 3 ));
-			if ( verbatim_bits < 0 )
-				return verbatim_bits;
-			verbatim_bits <<= 3;
-			aligned_bits = lzx_decode ( lzx, &lzx->alignoffset );
-			if ( aligned_bits < 0 )
-				return aligned_bits;
 		} else {
-			verbatim_bits = lzx_getbits ( lzx, offset_bits );
-			if ( verbatim_bits < 0 )
-				return verbatim_bits;
-			aligned_bits = 0;
+
+			/* Non-repeated offset */
+			offset_bits = lzx_footer_bits ( position_slot );
+			if ( alignoffset && ( offset_bits >= 3 ) ) {
+				verbatim_bits =
+					lzx_getbits ( lzx, ( offset_bits - 3 ) );
+				if ( verbatim_bits < 0 )
+					return verbatim_bits;
+				verbatim_bits <<= 3;
+				aligned_bits =
+					lzx_decode ( lzx, &lzx->alignoffset );
+				if ( aligned_bits < 0 )
+					return aligned_bits;
+			} else if ( offset_bits > 16 ) {
+				/* Footer is too wide to fetch at once */
+				verbatim_bits =
+					lzx_getbits ( lzx, ( offset_bits - 16 ) );
+				if ( verbatim_bits < 0 )
+					return verbatim_bits;
+				aligned_bits = lzx_getbits ( lzx, 16 );
+				if ( aligned_bits < 0 )
+					return aligned_bits;
+				verbatim_bits <<= 16;
+			} else {
+				verbatim_bits = lzx_getbits ( lzx, offset_bits );
+				if ( verbatim_bits < 0 )
+					return verbatim_bits;
+				aligned_bits = 0;
+			}
+			match_offset = ( lzx_position_base[position_slot] +
+					 verbatim_bits + aligned_bits - 2 );
+
+			/* Update repeated offset list */
+			for ( i = ( LZX_REPEATED_OFFSETS - 1 ) ; i > 0 ; i-- ) {
+				lzx->repeated_offset[i] =
+					lzx->repeated_offset[ i - 1 ];
+			}
+			lzx->repeated_offset[0] = match_offset;
 		}
-		match_offset = ( lzx_position_base[position_slot] +
-				 verbatim_bits + aligned_bits - 2 );
 
-		/* Update repeated offset list */
-		for ( i = ( LZX_REPEATED_OFFSETS - 1 ) ; i > 0 ; i-- )
-			lzx->repeated_offset[i] = lzx->repeated_offset[ i - 1 ];
-		lzx->repeated_offset[0] = match_offset;
+		/* Copy data */
+		if ( ( match_offset == 0 ) ||
+		     ( match_offset > lzx->output.offset ) ) {
+			DBG ( "LZX match underrun out %#zx offset %#zx len "
+			      "%#zx\n", lzx->output.offset, match_offset,
+			      match_length );
+			return -1;
+		}
+		if ( match_length > ( lzx->output.len - lzx->output.offset ) ) {
+			DBG ( "LZX match overrun out %#zx/%#zx len %#zx\n",
+			      lzx->output.offset, lzx->output.len,
+			      match_length );
+			return -1;
+		}
+		lz77_copy ( &lzx->output.data[lzx->output.offset],
+			    match_offset, match_length );
+		lzx->output.offset += match_length;
 	}
 
-	/* Copy data */
-	if ( match_offset > lzx->output.offset ) {
-		DBG ( "LZX match underrun out %#zx offset %#zx len %#zx\n",
-		      lzx->output.offset, match_offset, match_length );
-		return -1;
+	return 0;
+}
+
+/**
+ * Process verbatim block
+ *
+ * @v lzx		Decompressor
+ * @v limit		Output offset at which to stop
+ * @ret rc		Return status code
+ */
+static int lzx_verbatim ( struct lzx *lzx, size_t limit ) {
+
+	return lzx_tokens ( lzx, 0, limit );
+}
+
+/**
+ * Process aligned offset block
+ *
+ * @v lzx		Decompressor
+ * @v limit		Output offset at which to stop
+ * @ret rc		Return status code
+ */
+static int lzx_alignoffset ( struct lzx *lzx, size_t limit ) {
+
+	return lzx_tokens ( lzx, 1, limit );
+}
+
+#ifdef __SSE2__
+
+/** A vector of bytes for E8 scanning */
+typedef char lzx_e8_vector_t __attribute__ (( vector_size ( 16 ) ));
+
+/**
+ * Find next possible E8 jump instruction
+ *
+ * @v data		Data
+ * @v offset		Starting offset
+ * @v limit		Ending offset
+ * @ret offset		Offset of next E8 byte, or limit if not found
+ */
+static inline __attribute__ (( always_inline )) size_t
+lzx_find_e8 ( const uint8_t *data, size_t offset, size_t limit ) {
+	const lzx_e8_vector_t e8 = {
+		0xe8, 0xe8, 0xe8, 0xe8, 0xe8, 0xe8, 0xe8, 0xe8,
+		0xe8, 0xe8, 0xe8, 0xe8, 0xe8, 0xe8, 0xe8, 0xe8,
+	};
+	lzx_e8_vector_t vector;
+	unsigned int mask;
+
+	/* Scan sixteen bytes at a time using SSE2 */
+	while ( ( offset + sizeof ( vector ) ) <= limit ) {
+		__builtin_memcpy ( &vector, &data[offset], sizeof ( vector ) );
+		mask = __builtin_ia32_pmovmskb128 ( vector == e8 );
+		if ( mask )
+			return ( offset + __builtin_ctz ( mask ) );
+		offset += sizeof ( vector );
 	}
-	if ( lzx->output.data ) {
-		copy = &lzx->output.data[lzx->output.offset];
-		for ( i = 0 ; i < match_length ; i++ )
-			copy[i] = copy[ i - match_offset ];
+
+	/* Scan remaining bytes individually */
+	while ( ( offset < limit ) && ( data[offset] != 0xe8 ) )
+		offset++;
+
+	return offset;
+}
+
+#else /* __SSE2__ */
+
+/** Native word with each byte set to one */
+#define LZX_E8_ONES ( ( ( unsigned long ) -1 ) / 0xff )
+
+/**
+ * Find next possible E8 jump instruction
+ *
+ * @v data		Data
+ * @v offset		Starting offset
+ * @v limit		Ending offset
+ * @ret offset		Offset of next E8 byte, or limit if not found
+ */
+static inline __attribute__ (( always_inline )) size_t
+lzx_find_e8 ( const uint8_t *data, size_t offset, size_t limit ) {
+	unsigned long word;
+	unsigned long zero;
+
+	/* Scan a word at a time.  After XORing with 0xe8, the lowest
+	 * zero byte (i.e. the first E8 byte, since all supported
+	 * architectures are little-endian) is identified exactly by
+	 * the lowest bit set in the usual zero byte test.
+	 */
+	while ( ( offset + sizeof ( word ) ) <= limit ) {
+		__builtin_memcpy ( &word, &data[offset], sizeof ( word ) );
+		word ^= ( 0xe8 * LZX_E8_ONES );
+		zero = ( ( word - LZX_E8_ONES ) & ~word &
+			 ( 0x80 * LZX_E8_ONES ) );
+		if ( zero )
+			return ( offset + ( __builtin_ctzl ( zero ) / 8 ) );
+		offset += sizeof ( word );
 	}
-	lzx->output.offset += match_length;
 
-	return 0;
+	/* Scan remaining bytes individually */
+	while ( ( offset < limit ) && ( data[offset] != 0xe8 ) )
+		offset++;
+
+	return offset;
 }
 
+#endif /* __SSE2__ */
+
 /**
  * Translate E8 jump addresses
  *
  * @v lzx		Decompressor
+ * @v data		Output buffer
+ * @v limit		Offset at which to stop scanning
+ *
+ * Scanning resumes from wherever the previous call stopped, so that
+ * translation may be applied incrementally as output is produced.
  */
-static void lzx_translate_jumps ( struct lzx *lzx ) {
+static void lzx_translate_jumps ( struct lzx *lzx, uint8_t *data,
+				  size_t limit ) {
 	size_t offset;
 	int32_t *target;
 
-	/* Sanity check */
-	if ( lzx->output.offset < 10 )
-		return;
-
 	/* Scan for jump instructions */
-	for ( offset = 0 ; offset < ( lzx->output.offset - 10 ) ; offset++ ) {
+	for ( offset = lzx->output.translated ; ; offset++ ) {
 
-		/* Check for jump instruction */
-		if ( lzx->output.data[offset] != 0xe8 )
-			continue;
+		/* Find next jump instruction */
+		offset = lzx_find_e8 ( data, offset, limit );
+		if ( offset >= limit )
+			break;
 
 		/* Translate jump target */
-		target = ( ( int32_t * ) &lzx->output.data[ offset + 1 ] );
+		target = ( ( int32_t * ) &data[ offset + 1 ] );
 		if ( *target >= 0 ) {
 			if ( *target < LZX_WIM_MAGIC_FILESIZE )
 				*target -= offset;
@@ -600,26 +804,38 @@ static void lzx_translate_jumps ( struct lzx *lzx ) {
 		}
 		offset += sizeof ( *target );
 	}
+	lzx->output.translated = offset;
 }
 
 /**
- * Decompress LZX-compressed data
+ * Initialise LZX decompressor
  *
+ * @v lzx		Decompressor
  * @v data		Compressed data
  * @v len		Length of compressed data
- * @v buf		Decompression buffer, or NULL
- * @ret out_len		Length of decompressed data, or negative error
+ * @v buf		Decompression buffer
+ * @v max_len		Length of decompression buffer
+ * @v window		Window size
+ * @ret rc		Return status code
+ *
+ * The compressed data and decompression buffer must remain valid
+ * until decompression is complete.
  */
-ssize_t lzx_decompress ( const void *data, size_t len, void *buf ) {
-	struct lzx lzx;
+int lzx_init ( struct lzx *lzx, const void *data, size_t len, void *buf,
+	       size_t max_len, size_t window ) {
+	unsigned int slots;
 	unsigned int i;
-	int rc;
 
-	/* Sanity check */
+	/* Sanity checks */
 	if ( len % 2 ) {
 		DBG ( "LZX cannot handle odd-length input data\n" );
 		return -1;
 	}
+	if ( ( window < LZX_MIN_WINDOW ) || ( window > LZX_MAX_WINDOW ) ||
+	     ( window & ( window - 1 ) ) ) {
+		DBG ( "LZX cannot handle window size %#zx\n", window );
+		return -1;
+	}
 
 	/* Initialise global state, if required */
 	if ( ! lzx_position_base[ LZX_POSITION_SLOTS - 1 ] ) {
@@ -630,41 +846,138 @@ ssize_t lzx_decompress ( const void *data, size_t len, void *buf ) {
 		}
 	}
 
+	/* Use only as many position slots as are needed for the window */
+	slots = 1;
+	while ( ( slots < LZX_POSITION_SLOTS ) &&
+		( lzx_position_base[slots] < window ) )
+		slots++;
+
 	/* Initialise decompressor */
-	memset ( &lzx, 0, sizeof ( lzx ) );
-	lzx.input.data = data;
-	lzx.input.len = len;
-	lzx.output.data = buf;
+	memset ( lzx, 0, sizeof ( *lzx ) );
+	lzx->input.data = data;
+	lzx->input.len = len;
+	lzx->output.data = buf;
+	lzx->output.len = max_len;
 	for ( i = 0 ; i < LZX_REPEATED_OFFSETS ; i++ )
-		lzx.repeated_offset[i] = 1;
+		lzx->repeated_offset[i] = 1;
+	lzx->window = window;
+	lzx->main_codes = ( LZX_MAIN_LIT_CODES + ( 8 * slots ) );
 
-	/* Process blocks */
-	while ( lzx.input.offset < lzx.input.len ) {
+	return 0;
+}
 
-		/* Process block header */
-		if ( ( rc = lzx_block_header ( &lzx ) ) != 0 )
-			return rc;
+/**
+ * Continue LZX decompression
+ *
+ * @v lzx		Decompressor
+ * @v out		Output buffer
+ * @v want		Required length of decompressed data
+ * @ret out_len		Length of final decompressed data, or negative error
+ *
+ * Decompression is suspended once at least the required length of
+ * output is final (i.e. no longer subject to E8 jump translation),
+ * and may be resumed by a subsequent call.  The returned length is
+ * less than the required length only if the compressed data ends
+ * first.
+ *
+ * Final data is placed in the output buffer, which may be the
+ * decompression buffer itself only if decompression is never
+ * suspended (since matches must copy untranslated data).
+ */
+ssize_t lzx_resume ( struct lzx *lzx, void *out, size_t want ) {
+	size_t stop;
+	size_t limit;
+	int rc;
 
-		/* Process block contents */
-		if ( lzx.block_type == LZX_BLOCK_UNCOMPRESSED ) {
+	/* Allow for the bytes following a possible jump instruction */
+	stop = ( ( ( want < lzx->output.len ) ? want : lzx->output.len ) +
+		 LZX_E8_TAIL );
 
-			/* Copy uncompressed data */
-			if ( ( rc = lzx_uncompressed ( &lzx ) ) != 0 )
-				return rc;
+	/* Process blocks */
+	while ( lzx->output.offset < stop ) {
 
-		} else {
+		/* Process block header, if at the end of a block */
+		if ( lzx->output.offset >= lzx->output.threshold ) {
+			if ( lzx->input.offset >= lzx->input.len )
+				break;
+			if ( ( rc = lzx_block_header ( lzx ) ) != 0 )
+				return rc;
+		}
 
-			/* Process token stream */
-			while ( lzx.output.offset < lzx.output.threshold ) {
-				if ( ( rc = lzx_token ( &lzx ) ) != 0 )
-					return rc;
-			}
+		/* Process block contents, as far as required */
+		limit = lzx->output.threshold;
+		if ( limit > stop )
+			limit = stop;
+		switch ( lzx->block_type ) {
+		case LZX_BLOCK_VERBATIM :
+			rc = lzx_verbatim ( lzx, limit );
+			break;
+		case LZX_BLOCK_ALIGNOFFSET :
+			rc = lzx_alignoffset ( lzx, limit );
+			break;
+		default:
+			rc = lzx_uncompressed ( lzx );
+			break;
 		}
+		if ( rc != 0 )
+			return rc;
+	}
+
+	/* Copy newly decompressed data to output buffer, if separate */
+	if ( out != lzx->output.data ) {
+		memcpy ( ( out + lzx->output.translated ),
+			 ( lzx->output.data + lzx->output.translated ),
+			 ( lzx->output.offset - lzx->output.translated ) );
 	}
 
 	/* Postprocess to undo E8 jump compression */
-	if ( lzx.output.data )
-		lzx_translate_jumps ( &lzx );
+	if ( lzx->output.offset >= LZX_E8_TAIL ) {
+		lzx_translate_jumps ( lzx, out, ( lzx->output.offset -
+						  LZX_E8_TAIL ) );
+	}
+
+	/* All output is final once the end of the data is reached */
+	if ( lzx->output.offset < stop )
+		return lzx->output.offset;
+	return lzx->output.translated;
+}
+
+/**
+ * Decompress LZX-compressed data with a specified window size
+ *
+ * @v data		Compressed data
+ * @v len		Length of compressed data
+ * @v buf		Decompression buffer
+ * @v max_len		Length of decompression buffer
+ * @v window		Window size
+ * @ret out_len		Length of decompressed data, or negative error
+ */
+ssize_t lzx_decompress_window ( const void *data, size_t len, void *buf,
+				size_t max_len, size_t window ) {
+	static struct lzx lzx; /* Too large to comfortably fit on the stack */
+	int rc;
+
+	/* Initialise decompressor */
+	if ( ( rc = lzx_init ( &lzx, data, len, buf, max_len,
+			       window ) ) != 0 )
+		return rc;
+
+	/* Decompress all data */
+	return lzx_resume ( &lzx, buf, max_len );
+}
+
+/**
+ * Decompress LZX-compressed data
+ *
+ * @v data		Compressed data
+ * @v len		Length of compressed data
+ * @v buf		Decompression buffer
+ * @v max_len		Length of decompression buffer
+ * @ret out_len		Length of decompressed data, or negative error
+ */
+ssize_t lzx_decompress ( const void *data, size_t len, void *buf,
+			 size_t max_len ) {
 
-	return lzx.output.offset;
+	return lzx_decompress_window ( data, len, buf, max_len,
+				       LZX_DEFAULT_WINDOW );
 }
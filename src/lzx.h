@@ -45,10 +45,10 @@
 /** Number of literal main codes */
 #define LZX_MAIN_LIT_CODES 256
 
-/** Number of position slots */
-#define LZX_POSITION_SLOTS 30
+/** Maximum number of position slots */
+#define LZX_POSITION_SLOTS 50
 
-/** Number of main codes */
+/** Maximum number of main codes */
 #define LZX_MAIN_CODES ( LZX_MAIN_LIT_CODES + ( 8 * LZX_POSITION_SLOTS ) )
 
 /** Number of length codes */
@@ -60,12 +60,27 @@
 /** Default block length */
 #define LZX_DEFAULT_BLOCK_LEN 32768
 
+/** Default window size (as used for WIM files) */
+#define LZX_DEFAULT_WINDOW 32768
+
+/** Minimum window size */
+#define LZX_MIN_WINDOW 32768
+
+/** Maximum window size */
+#define LZX_MAX_WINDOW ( 2 * 1024 * 1024 )
+
+/** Smallest window size for which block lengths are 24 bits */
+#define LZX_WIDE_BLOCK_WINDOW 65536
+
 /** Number of repeated offsets */
 #define LZX_REPEATED_OFFSETS 3
 
 /** Don't ask */
 #define LZX_WIM_MAGIC_FILESIZE 12000000
 
+/** Number of trailing output bytes never subject to E8 jump translation */
+#define LZX_E8_TAIL 10
+
 /** Block types */
 enum lzx_block_type {
 	/** Verbatim block */
@@ -88,14 +103,28 @@ struct lzx_input_stream {
 
 /** An LZX output stream */
 struct lzx_output_stream {
-	/** Data, or NULL */
+	/** Data */
 	uint8_t *data;
+	/** Length */
+	size_t len;
 	/** Offset within stream */
 	size_t offset;
 	/** End of current block within stream */
 	size_t threshold;
+	/** Offset up to which E8 jump translation has been applied */
+	size_t translated;
 };
 
+/** LZX bit accumulator
+ *
+ * The accumulator is the native word size, allowing several 16-bit
+ * input words to be fetched at once on 64-bit platforms.
+ */
+typedef unsigned long lzx_accumulator_t;
+
+/** Length of LZX bit accumulator (in bits) */
+#define LZX_ACCUMULATOR_BITS ( 8 * sizeof ( lzx_accumulator_t ) )
+
 /** LZX decompressor */
 struct lzx {
 	/** Input stream */
@@ -103,13 +132,26 @@ struct lzx {
 	/** Output stream */
 	struct lzx_output_stream output;
 	/** Accumulator */
-	uint32_t accumulator;
+	lzx_accumulator_t accumulator;
 	/** Number of bits in accumulator */
 	unsigned int bits;
+	/** Number of bits that would be held by a minimal accumulator
+	 *
+	 * The padding preceding an uncompressed block is defined as
+	 * being all of the bits held by a decoder that fetches a
+	 * single 16-bit input word only when it has too few bits to
+	 * satisfy a request.  We fetch input words in advance, and so
+	 * must track the bits that such a decoder would hold.
+	 */
+	unsigned int held;
 	/** Block type */
 	enum lzx_block_type block_type;
 	/** Repeated offsets */
 	unsigned int repeated_offset[LZX_REPEATED_OFFSETS];
+	/** Window size */
+	size_t window;
+	/** Number of main codes */
+	unsigned int main_codes;
 
 	/** Aligned offset Huffman alphabet */
 	struct huffman_alphabet alignoffset;
@@ -175,6 +217,13 @@ static inline unsigned int lzx_footer_bits ( unsigned int position_slot ) {
 	}
 }
 
-extern ssize_t lzx_decompress ( const void *data, size_t len, void *buf );
+extern int lzx_init ( struct lzx *lzx, const void *data, size_t len,
+		      void *buf, size_t max_len, size_t window );
+extern ssize_t lzx_resume ( struct lzx *lzx, void *out, size_t want );
+extern ssize_t lzx_decompress_window ( const void *data, size_t len,
+				       void *buf, size_t max_len,
+				       size_t window );
+extern ssize_t lzx_decompress ( const void *data, size_t len, void *buf,
+				size_t max_len );
 
 #endif /* _LZX_H */
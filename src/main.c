@@ -43,6 +43,7 @@
 #include "pause.h"
 #include "paging.h"
 #include "memmap.h"
+#include "malloc.h"
 
 /** Start of our image (defined by linker) */
 extern char _start[];
@@ -59,11 +60,9 @@ void *initrd;
 /** Length of initrd */
 size_t initrd_len;
 
-/** bootmgr.exe path within WIM */
-static const wchar_t bootmgr_path[] = L"\\Windows\\Boot\\PXE\\bootmgr.exe";
-
-/** Other paths within WIM */
+/** Paths within WIM (with bootmgr.exe first) */
 static const wchar_t *wim_paths[] = {
+	L"\\Windows\\Boot\\PXE\\bootmgr.exe",
 	L"\\Windows\\Boot\\DVD\\PCAT\\boot.sdi",
 	L"\\Windows\\Boot\\DVD\\PCAT\\BCD",
 	L"\\Windows\\Boot\\Fonts\\segmono_boot.ttf",
@@ -83,6 +82,16 @@ static struct vdisk_file *bootwim;
 /** Minimal length of embedded bootmgr.exe */
 #define BOOTMGR_MIN_LEN 16384
 
+/** Maximal length of bootmgr.exe prepended to the initrd */
+#define BOOTMGR_MAX_LEN ( 8 * 1024 * 1024 )
+
+/** Space required below the initrd
+ *
+ * The heap and (if not directly usable in place) bootmgr.exe are
+ * prepended to the initrd after it has been placed.
+ */
+#define INITRD_HEADROOM ( HEAP_SIZE + BOOTMGR_MAX_LEN )
+
 /** 1MB memory threshold */
 #define ADDR_1MB 0x00100000
 
@@ -260,7 +269,8 @@ static struct vdisk_file * add_bootmgr ( const void *data, size_t len ) {
 	const uint8_t *compressed;
 	size_t offset;
 	size_t compressed_len;
-	ssize_t ( * decompress ) ( const void *data, size_t len, void *buf );
+	ssize_t ( * decompress ) ( const void *data, size_t len, void *buf,
+				   size_t max_len );
 	ssize_t decompressed_len;
 	size_t padded_len;
 
@@ -321,7 +331,7 @@ static struct vdisk_file * add_bootmgr ( const void *data, size_t len ) {
 
 		/* Find length of decompressed image */
 		decompressed_len = decompress ( compressed, compressed_len,
-						NULL );
+						NULL, 0 );
 		if ( decompressed_len < 0 ) {
 			/* May be a false positive signature match */
 			continue;
@@ -333,7 +343,8 @@ static struct vdisk_file * add_bootmgr ( const void *data, size_t len ) {
 			       ~( PAGE_SIZE - 1 ) );
 		initrd -= padded_len;
 		initrd_len += padded_len;
-		decompress ( compressed, compressed_len, initrd );
+		decompress ( compressed, compressed_len, initrd,
+			     decompressed_len );
 
 		/* Add decompressed image */
 		return vdisk_add_file ( "bootmgr.exe", initrd,
@@ -377,14 +388,38 @@ static int add_file ( const char *name, void *data, size_t len ) {
 	return 0;
 }
 
+/**
+ * Check for available memory immediately below data
+ *
+ * @v data		Start of data
+ * @v headroom		Space required immediately below data
+ * @ret available	Space is available
+ */
+static int check_headroom ( void *data, size_t headroom ) {
+	struct e820_entry *e820 = NULL;
+	intptr_t start = ( ( intptr_t ) data );
+
+	/* Read system memory map */
+	while ( ( e820 = memmap_next ( e820 ) ) != NULL ) {
+		if ( ( start >= ( ADDR_1MB + headroom ) ) &&
+		     ( start >= ( e820->start + headroom ) ) &&
+		     ( start <= ( e820->start + e820->len ) ) )
+			return 1;
+	}
+
+	return 0;
+}
+
 /**
  * Relocate data between 1MB and 2GB if possible
  *
  * @v data		Start of data
  * @v len		Length of data
- * @ret start		Start address
+ * @v headroom		Space required immediately below data
+ * @ret start		Start address, or NULL if data could not be relocated
  */
-static void * relocate_memory_low ( void *data, size_t len ) {
+static void * relocate_memory_low ( void *data, size_t len,
+				    size_t headroom ) {
 	struct e820_entry *e820 = NULL;
 	uint64_t end;
 	intptr_t start;
@@ -395,13 +430,13 @@ static void * relocate_memory_low ( void *data, size_t len ) {
 		/* Find highest compatible placement within this region */
 		end = ( e820->start + e820->len );
 		start = ( ( end > ADDR_2GB ) ? ADDR_2GB : end );
-		if ( start < len )
+		if ( start < ( len + headroom ) )
 			continue;
 		start -= len;
 		start &= ~( PAGE_SIZE - 1 );
-		if ( start < e820->start )
+		if ( start < ( e820->start + headroom ) )
 			continue;
-		if ( start < ADDR_1MB )
+		if ( start < ( ADDR_1MB + headroom ) )
 			continue;
 
 		/* Relocate to this region */
@@ -409,8 +444,30 @@ static void * relocate_memory_low ( void *data, size_t len ) {
 		return ( ( void * ) start );
 	}
 
-	/* Leave at original location */
-	return data;
+	return NULL;
+}
+
+/**
+ * Reserve memory below initrd
+ *
+ * @v len		Length
+ * @ret ptr		Memory, or NULL on failure
+ *
+ * The reserved memory is prepended to the initrd, and so remains
+ * protected from bootmgr.exe along with the rest of the initrd.
+ */
+static void * reserve_memory_low ( size_t len ) {
+	size_t padded_len = ( ( len + PAGE_SIZE - 1 ) & ~( PAGE_SIZE - 1 ) );
+
+	/* Leave space for bootmgr.exe to be prepended subsequently */
+	if ( ! check_headroom ( initrd, ( padded_len + BOOTMGR_MAX_LEN ) ) )
+		return NULL;
+
+	/* Prepend to initrd */
+	initrd -= padded_len;
+	initrd_len += padded_len;
+	DBG ( "Reserved [%p,%p)\n", initrd, ( initrd + padded_len ) );
+	return initrd;
 }
 
 /**
@@ -418,11 +475,14 @@ static void * relocate_memory_low ( void *data, size_t len ) {
  *
  */
 int main ( void ) {
+	struct vdisk_file *files[ sizeof ( wim_paths ) /
+				  sizeof ( wim_paths[0] ) ];
 	size_t padded_len;
 	void *raw_pe;
 	struct loaded_pe pe;
 	struct paging_state state;
 	uint64_t initrd_phys;
+	void *relocated;
 
 	/* Initialise stack cookie */
 	init_cookie();
@@ -440,24 +500,45 @@ int main ( void ) {
 	/* Enable paging */
 	enable_paging ( &state );
 
-	/* Relocate initrd below 2GB if possible, to avoid collisions */
+	/* Relocate initrd below 2GB if possible, to avoid collisions.
+	 * Leave space below the initrd for the heap and bootmgr.exe
+	 * if possible, but relocate even if there is no such space
+	 * (since the heap is optional).
+	 */
 	DBG ( "Found initrd at [%p,%p)\n", initrd, ( initrd + initrd_len ) );
-	initrd = relocate_memory_low ( initrd, initrd_len );
+	relocated = relocate_memory_low ( initrd, initrd_len, INITRD_HEADROOM );
+	if ( ! relocated )
+		relocated = relocate_memory_low ( initrd, initrd_len, 0 );
+	if ( relocated )
+		initrd = relocated;
 	DBG ( "Placing initrd at [%p,%p)\n", initrd, ( initrd + initrd_len ) );
 
 	/* Extract files from initrd */
 	if ( cpio_extract ( initrd, initrd_len, add_file ) != 0 )
 		die ( "FATAL: could not extract initrd files\n" );
 
-	/* Process WIM image */
+	/* Prepend heap to initrd, if there is space to do so (leaving
+	 * space for bootmgr.exe to be prepended subsequently).
+	 * Otherwise, run without a heap.
+	 */
+	if ( check_headroom ( initrd, INITRD_HEADROOM ) ) {
+		initrd -= HEAP_SIZE;
+		initrd_len += HEAP_SIZE;
+		mpopulate ( initrd, HEAP_SIZE );
+	} else {
+		DBG ( "No space below initrd for heap\n" );
+	}
+
+	/* Process WIM image, allowing large buffers (if required) to
+	 * be reserved below the initrd.
+	 */
 	if ( bootwim ) {
+		mreserve = reserve_memory_low;
 		vdisk_patch_file ( bootwim, patch_wim );
-		if ( ( ! bootmgr ) &&
-		     ( bootmgr = wim_add_file ( bootwim, cmdline_index,
-						bootmgr_path ) ) ) {
+		wim_add_files ( bootwim, cmdline_index, wim_paths, files );
+		if ( ( ! bootmgr ) && ( bootmgr = files[0] ) )
 			DBG ( "...extracted bootmgr.exe\n" );
-		}
-		wim_add_files ( bootwim, cmdline_index, wim_paths );
+		mreserve = NULL;
 	}
 
 	/* Add INT 13 drive */
@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2026 Michael Brown <mbrown@fensystems.co.uk>.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * @file
+ *
+ * Dynamic memory allocation
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "wimboot.h"
+#include "malloc.h"
+
+/** A free block of memory */
+struct memory_block {
+	/** Size of this block (including this header) */
+	size_t size;
+	/** Next free block (in address order) */
+	struct memory_block *next;
+};
+
+/** Memory block alignment (and size of an allocated block header) */
+#define MEMBLOCK_ALIGN 16
+
+/** An allocated block of memory */
+struct autosized_block {
+	/** Size of this block (including this header) */
+	size_t size;
+	/** Padding to alignment boundary */
+	uint8_t pad[ MEMBLOCK_ALIGN - sizeof ( size_t ) ];
+	/** Remaining data */
+	uint8_t data[0];
+};
+
+/** List of free memory blocks */
+static struct memory_block *free_blocks;
+
+/**
+ * Reserve memory directly from the platform
+ *
+ * @v len		Length
+ * @ret ptr		Memory, or NULL on failure
+ *
+ * This is NULL whenever the platform is unable to reserve memory
+ * (e.g. for BIOS once the initrd's final extent has been fixed).
+ */
+void * ( * mreserve ) ( size_t len );
+
+/**
+ * Memory may be reserved directly from the platform at any time
+ *
+ * This is set if @c mreserve remains available after startup
+ * (e.g. for UEFI, where memory is reserved from the firmware).
+ */
+int mreserve_persistent;
+
+/**
+ * Add memory to the heap
+ *
+ * @v start		Start address
+ * @v len		Length
+ */
+void mpopulate ( void *start, size_t len ) {
+	struct autosized_block *block;
+	size_t skip;
+
+	/* Align start of region */
+	skip = ( -( ( intptr_t ) start ) & ( MEMBLOCK_ALIGN - 1 ) );
+	if ( len < ( skip + MEMBLOCK_ALIGN ) )
+		return;
+	start += skip;
+	len -= skip;
+	len &= ~( MEMBLOCK_ALIGN - 1 );
+	DBG ( "Heap at [%p,%p)\n", start, ( start + len ) );
+
+	/* Add to free list */
+	block = start;
+	block->size = len;
+	free ( block->data );
+}
+
+/**
+ * Allocate memory
+ *
+ * @v size		Requested size
+ * @ret ptr		Memory, or NULL on failure
+ */
+void * malloc ( size_t size ) {
+	struct memory_block **prev;
+	struct memory_block *block;
+	struct autosized_block *allocated;
+	size_t len;
+
+	/* Calculate block size (including header) */
+	if ( size > ( ( ( size_t ) -1 ) - ( 2 * MEMBLOCK_ALIGN ) ) )
+		return NULL;
+	len = ( ( size + sizeof ( *allocated ) + MEMBLOCK_ALIGN - 1 ) &
+		~( MEMBLOCK_ALIGN - 1 ) );
+
+	/* Find first free block large enough */
+	for ( prev = &free_blocks ; ( block = *prev ) ; prev = &block->next ) {
+
+		/* Skip blocks that are too small */
+		if ( block->size < len )
+			continue;
+
+		/* Take whole block, or allocate from end of block */
+		if ( block->size == len ) {
+			*prev = block->next;
+			allocated = ( ( void * ) block );
+		} else {
+			block->size -= len;
+			allocated = ( ( ( void * ) block ) + block->size );
+		}
+		allocated->size = len;
+		DBG2 ( "Allocated [%p,%p)\n", allocated->data,
+		       ( ( ( void * ) allocated ) + len ) );
+		return allocated->data;
+	}
+
+	DBG2 ( "Could not allocate %#zx bytes\n", size );
+	return NULL;
+}
+
+/**
+ * Free memory
+ *
+ * @v ptr		Memory, or NULL
+ */
+void free ( void *ptr ) {
+	struct autosized_block *allocated;
+	struct memory_block **prev;
+	struct memory_block *block;
+	struct memory_block *freed;
+
+	/* Do nothing if pointer is NULL */
+	if ( ! ptr )
+		return;
+
+	/* Identify block (whose size field is already in place) */
+	allocated = container_of ( ptr, struct autosized_block, data );
+	freed = ( ( void * ) allocated );
+
+	/* Find insertion point in address-ordered free list */
+	for ( prev = &free_blocks ; ( block = *prev ) ; prev = &block->next ) {
+		if ( block > freed )
+			break;
+	}
+
+	/* Merge with following block, if adjacent */
+	if ( block && ( ( ( ( void * ) freed ) + freed->size ) ==
+			( ( void * ) block ) ) ) {
+		freed->size += block->size;
+		block = block->next;
+	}
+	freed->next = block;
+
+	/* Merge with preceding block, if adjacent */
+	if ( prev != &free_blocks ) {
+		block = container_of ( prev, struct memory_block, next );
+		if ( ( ( ( void * ) block ) + block->size ) ==
+		     ( ( void * ) freed ) ) {
+			block->size += freed->size;
+			block->next = freed->next;
+			return;
+		}
+	}
+	*prev = freed;
+}
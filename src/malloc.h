@@ -0,0 +1,52 @@
+#ifndef _MALLOC_H
+#define _MALLOC_H
+
+/*
+ * Copyright (C) 2026 Michael Brown <mbrown@fensystems.co.uk>.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * @file
+ *
+ * Dynamic memory allocation
+ *
+ * The heap is a single region of memory reserved during startup
+ * (below the initrd for BIOS, or from the firmware for UEFI).  All
+ * allocations must be treated as optional: the heap is never grown,
+ * and callers must fall back to working without the memory if an
+ * allocation fails.
+ *
+ * Buffers too large for the heap (such as those used for decoding
+ * solid resource chunks) may instead be reserved directly from the
+ * platform, where the platform allows.  Such reservations are never
+ * freed.  Where the platform continues to allow reservations after
+ * startup, callers may defer reserving memory until it is needed.
+ *
+ */
+
+#include <stdint.h>
+
+/** Size of heap */
+#define HEAP_SIZE ( 8 * 1024 * 1024 )
+
+extern void * ( * mreserve ) ( size_t len );
+extern int mreserve_persistent;
+
+extern void mpopulate ( void *start, size_t len );
+
+#endif /* _MALLOC_H */
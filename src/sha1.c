@@ -30,150 +30,473 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <string.h>
 #include <byteswap.h>
-#include <assert.h>
+#include "wimboot.h"
 #include "rotate.h"
 #include "sha1.h"
 
-/** SHA-1 variables */
-struct sha1_variables {
-	/* This layout matches that of struct sha1_digest_data,
-	 * allowing for efficient endianness-conversion,
-	 */
+/** SHA-1 block size */
+#define SHA1_BLOCK_SIZE sizeof ( union sha1_block )
+
+/** f(b,c,d) for steps 0 to 19 */
+#define SHA1_F_0_19( b, c, d ) ( (d) ^ ( (b) & ( (c) ^ (d) ) ) )
+
+/** f(b,c,d) for steps 20 to 39 and 60 to 79 */
+#define SHA1_F_20_39_60_79( b, c, d ) ( (b) ^ (c) ^ (d) )
+
+/** f(b,c,d) for steps 40 to 59 */
+#define SHA1_F_40_59( b, c, d ) ( ( (b) & (c) ) | ( (d) & ( (b) | (c) ) ) )
+
+/** Constant k for steps 0 to 19 */
+#define SHA1_K_0_19 0x5a827999
+
+/** Constant k for steps 20 to 39 */
+#define SHA1_K_20_39 0x6ed9eba1
+
+/** Constant k for steps 40 to 59 */
+#define SHA1_K_40_59 0x8f1bbcdc
+
+/** Constant k for steps 60 to 79 */
+#define SHA1_K_60_79 0xca62c1d6
+
+/**
+ * Get message schedule word w[i]
+ *
+ * The schedule is held as a 16-word circular buffer, with w[i] for
+ * i >= 16 being calculated in place as it is first required.
+ */
+#define SHA1_W( i ) ( ( (i) < 16 ) ? w[ (i) ] :				\
+		      ( w[ (i) & 15 ] =					\
+			rol32 ( ( w[ ( (i) - 3 ) & 15 ] ^		\
+				  w[ ( (i) - 8 ) & 15 ] ^		\
+				  w[ ( (i) - 14 ) & 15 ] ^		\
+				  w[ (i) & 15 ] ), 1 ) ) )
+
+/**
+ * Perform a single SHA-1 step
+ *
+ * Rather than shuffling the variables at the end of each step, the
+ * caller rotates the roles of the variables between steps.
+ */
+#define SHA1_STEP( a, b, c, d, e, f, k, i ) do {			\
+	e += ( rol32 ( a, 5 ) + f ( b, c, d ) + k + SHA1_W ( i ) );	\
+	b = rol32 ( b, 30 );						\
+	} while ( 0 )
+
+/** Perform five SHA-1 steps, returning the variables to their roles */
+#define SHA1_STEP5( f, k, i ) do {					\
+	SHA1_STEP ( a, b, c, d, e, f, k, ( (i) + 0 ) );			\
+	SHA1_STEP ( e, a, b, c, d, f, k, ( (i) + 1 ) );			\
+	SHA1_STEP ( d, e, a, b, c, f, k, ( (i) + 2 ) );			\
+	SHA1_STEP ( c, d, e, a, b, f, k, ( (i) + 3 ) );			\
+	SHA1_STEP ( b, c, d, e, a, f, k, ( (i) + 4 ) );			\
+	} while ( 0 )
+
+/** Perform twenty SHA-1 steps */
+#define SHA1_STEP20( f, k, i ) do {					\
+	for ( step = (i) ; step < ( (i) + 20 ) ; step += 5 )		\
+		SHA1_STEP5 ( f, k, step );				\
+	} while ( 0 )
+
+/**
+ * Calculate SHA-1 digest of data blocks
+ *
+ * @v digest		Digest of data already processed (host-endian)
+ * @v data		Data blocks
+ * @v count		Number of data blocks
+ */
+static void sha1_blocks_generic ( struct sha1_digest *digest,
+				  const void *data, size_t count ) {
+	const uint8_t *block = data;
+	uint32_t w[16];
 	uint32_t a;
 	uint32_t b;
 	uint32_t c;
 	uint32_t d;
 	uint32_t e;
-	uint32_t w[80];
-} __attribute__ (( packed ));
+	unsigned int step;
+	unsigned int i;
+
+	for ( ; count-- ; block += SHA1_BLOCK_SIZE ) {
+
+		/* Initialise w[0..15] */
+		memcpy ( w, block, sizeof ( w ) );
+		for ( i = 0 ; i < ( sizeof ( w ) / sizeof ( w[0] ) ) ; i++ )
+			be32_to_cpus ( &w[i] );
+
+		/* Initialise a, b, c, d, and e */
+		a = digest->h[0];
+		b = digest->h[1];
+		c = digest->h[2];
+		d = digest->h[3];
+		e = digest->h[4];
+
+		/* Main loop */
+		SHA1_STEP20 ( SHA1_F_0_19, SHA1_K_0_19, 0 );
+		SHA1_STEP20 ( SHA1_F_20_39_60_79, SHA1_K_20_39, 20 );
+		SHA1_STEP20 ( SHA1_F_40_59, SHA1_K_40_59, 40 );
+		SHA1_STEP20 ( SHA1_F_20_39_60_79, SHA1_K_60_79, 60 );
+
+		/* Add block to hash */
+		digest->h[0] += a;
+		digest->h[1] += b;
+		digest->h[2] += c;
+		digest->h[3] += d;
+		digest->h[4] += e;
+	}
+}
+
+#ifdef __x86_64__
+
+/** CPUID leaf for basic features */
+#define SHA1_CPUID_FEATURES 0x00000001
+
+/** CPUID leaf for structured extended features */
+#define SHA1_CPUID_EXTENDED 0x00000007
+
+/** SSSE3 is supported */
+#define SHA1_CPUID_FEATURE_ECX_SSSE3 0x00000200
+
+/** SHA extensions are supported */
+#define SHA1_CPUID_EXTENDED_EBX_SHA 0x20000000
+
+/** Byte shuffle mask to convert big-endian dwords to host order */
+static const uint8_t sha1_ni_mask[16] __attribute__ (( aligned ( 16 ) )) = {
+	0x0f, 0x0e, 0x0d, 0x0c, 0x0b, 0x0a, 0x09, 0x08,
+	0x07, 0x06, 0x05, 0x04, 0x03, 0x02, 0x01, 0x00,
+};
 
 /**
- * f(a,b,c,d) for steps 0 to 19
+ * Perform four SHA-1 steps using SHA extensions
  *
- * @v v		SHA-1 variables
- * @ret f	f(a,b,c,d)
+ * Register %xmm0 holds a, b, c, and d.  Registers %xmm1 and %xmm2
+ * alternately hold e (combined with the message schedule) and a copy
+ * of the variables used to calculate the next e.
  */
-static uint32_t sha1_f_0_19 ( struct sha1_variables *v ) {
-	return ( ( v->b & v->c ) | ( (~v->b) & v->d ) );
-}
+#define SHA1_NI_STEP4( e, next, w, k )					\
+	"sha1nexte %%xmm" #w ", %%xmm" #e "\n\t"			\
+	"movdqa %%xmm0, %%xmm" #next "\n\t"				\
+	"sha1rnds4 $" #k ", %%xmm" #e ", %%xmm0\n\t"
+
+/** Load four message schedule words using SHA extensions */
+#define SHA1_NI_LOAD( w, offset )					\
+	"movdqu " #offset "(%0), %%xmm" #w "\n\t"			\
+	"pshufb %%xmm7, %%xmm" #w "\n\t"
+
+/** Start calculating message schedule words using SHA extensions */
+#define SHA1_NI_MSG1( w, x )						\
+	"sha1msg1 %%xmm" #x ", %%xmm" #w "\n\t"
+
+/** Continue calculating message schedule words using SHA extensions */
+#define SHA1_NI_XOR( w, x )						\
+	"pxor %%xmm" #x ", %%xmm" #w "\n\t"
+
+/** Finish calculating message schedule words using SHA extensions */
+#define SHA1_NI_MSG2( w, x )						\
+	"sha1msg2 %%xmm" #x ", %%xmm" #w "\n\t"
+
+/**
+ * Perform four SHA-1 steps and advance message schedule
+ *
+ * Registers %xmm3 to %xmm6 hold a sliding window of sixteen message
+ * schedule words, with each set of four words passing through the
+ * MSG1, XOR, and MSG2 stages before being consumed.
+ */
+#define SHA1_NI_STEP4_MSG( e, next, w, x, y, z, k )			\
+	SHA1_NI_STEP4 ( e, next, w, k )					\
+	SHA1_NI_MSG2 ( x, w )						\
+	SHA1_NI_XOR ( y, w )						\
+	SHA1_NI_MSG1 ( z, w )
 
 /**
- * f(a,b,c,d) for steps 20 to 39 and 60 to 79
+ * Check for SHA extensions
  *
- * @v v		SHA-1 variables
- * @ret f	f(a,b,c,d)
+ * @ret supported	SHA extensions are supported on this CPU
  */
-static uint32_t sha1_f_20_39_60_79 ( struct sha1_variables *v ) {
-	return ( v->b ^ v->c ^ v->d );
+static int sha1_ni_supported ( void ) {
+	uint32_t eax;
+	uint32_t ebx;
+	uint32_t ecx;
+	uint32_t edx;
+
+	/* Check for SSSE3 */
+	__asm__ ( "cpuid"
+		  : "=a" ( eax ), "=b" ( ebx ), "=c" ( ecx ), "=d" ( edx )
+		  : "0" ( SHA1_CPUID_FEATURES ) );
+	if ( ! ( ecx & SHA1_CPUID_FEATURE_ECX_SSSE3 ) )
+		return 0;
+
+	/* Check for SHA extensions */
+	__asm__ ( "cpuid"
+		  : "=a" ( eax ), "=b" ( ebx ), "=c" ( ecx ), "=d" ( edx )
+		  : "0" ( 0 ) );
+	if ( eax < SHA1_CPUID_EXTENDED )
+		return 0;
+	__asm__ ( "cpuid"
+		  : "=a" ( eax ), "=b" ( ebx ), "=c" ( ecx ), "=d" ( edx )
+		  : "0" ( SHA1_CPUID_EXTENDED ), "2" ( 0 ) );
+	if ( ! ( ebx & SHA1_CPUID_EXTENDED_EBX_SHA ) )
+		return 0;
+
+	return 1;
 }
 
 /**
- * f(a,b,c,d) for steps 40 to 59
+ * Calculate SHA-1 digest of data blocks using SHA extensions
  *
- * @v v		SHA-1 variables
- * @ret f	f(a,b,c,d)
+ * @v digest		Digest of data already processed (host-endian)
+ * @v data		Data blocks
+ * @v count		Number of data blocks (must be non-zero)
  */
-static uint32_t sha1_f_40_59 ( struct sha1_variables *v ) {
-	return ( ( v->b & v->c ) | ( v->b & v->d ) | ( v->c & v->d ) );
+static void sha1_blocks_ni ( struct sha1_digest *digest, const void *data,
+			     size_t count ) {
+
+	__asm__ __volatile__ ( /* Load a, b, c, d, and e */
+			       "movdqu (%2), %%xmm0\n\t"
+			       "pshufd $0x1b, %%xmm0, %%xmm0\n\t"
+			       "movd 16(%2), %%xmm1\n\t"
+			       "pslldq $12, %%xmm1\n\t"
+			       "movdqa %3, %%xmm7\n\t"
+			       "\n1:\n\t"
+			       /* Record digest of data already processed */
+			       "movdqa %%xmm0, %%xmm8\n\t"
+			       "movdqa %%xmm1, %%xmm9\n\t"
+			       /* Steps 0 to 19 */
+			       SHA1_NI_LOAD ( 3, 0 )
+			       "paddd %%xmm3, %%xmm1\n\t"
+			       "movdqa %%xmm0, %%xmm2\n\t"
+			       "sha1rnds4 $0, %%xmm1, %%xmm0\n\t"
+			       SHA1_NI_LOAD ( 4, 16 )
+			       SHA1_NI_STEP4 ( 2, 1, 4, 0 )
+			       SHA1_NI_MSG1 ( 3, 4 )
+			       SHA1_NI_LOAD ( 5, 32 )
+			       SHA1_NI_STEP4 ( 1, 2, 5, 0 )
+			       SHA1_NI_XOR ( 3, 5 )
+			       SHA1_NI_MSG1 ( 4, 5 )
+			       SHA1_NI_LOAD ( 6, 48 )
+			       SHA1_NI_STEP4_MSG ( 2, 1, 6, 3, 4, 5, 0 )
+			       SHA1_NI_STEP4_MSG ( 1, 2, 3, 4, 5, 6, 0 )
+			       /* Steps 20 to 39 */
+			       SHA1_NI_STEP4_MSG ( 2, 1, 4, 5, 6, 3, 1 )
+			       SHA1_NI_STEP4_MSG ( 1, 2, 5, 6, 3, 4, 1 )
+			       SHA1_NI_STEP4_MSG ( 2, 1, 6, 3, 4, 5, 1 )
+			       SHA1_NI_STEP4_MSG ( 1, 2, 3, 4, 5, 6, 1 )
+			       SHA1_NI_STEP4_MSG ( 2, 1, 4, 5, 6, 3, 1 )
+			       /* Steps 40 to 59 */
+			       SHA1_NI_STEP4_MSG ( 1, 2, 5, 6, 3, 4, 2 )
+			       SHA1_NI_STEP4_MSG ( 2, 1, 6, 3, 4, 5, 2 )
+			       SHA1_NI_STEP4_MSG ( 1, 2, 3, 4, 5, 6, 2 )
+			       SHA1_NI_STEP4_MSG ( 2, 1, 4, 5, 6, 3, 2 )
+			       SHA1_NI_STEP4_MSG ( 1, 2, 5, 6, 3, 4, 2 )
+			       /* Steps 60 to 79 */
+			       SHA1_NI_STEP4_MSG ( 2, 1, 6, 3, 4, 5, 3 )
+			       SHA1_NI_STEP4_MSG ( 1, 2, 3, 4, 5, 6, 3 )
+			       SHA1_NI_STEP4 ( 2, 1, 4, 3 )
+			       SHA1_NI_MSG2 ( 5, 4 )
+			       SHA1_NI_XOR ( 6, 4 )
+			       SHA1_NI_STEP4 ( 1, 2, 5, 3 )
+			       SHA1_NI_MSG2 ( 6, 5 )
+			       SHA1_NI_STEP4 ( 2, 1, 6, 3 )
+			       /* Add block to hash */
+			       "sha1nexte %%xmm9, %%xmm1\n\t"
+			       "paddd %%xmm8, %%xmm0\n\t"
+			       "addq $64, %0\n\t"
+			       "decq %1\n\t"
+			       "jnz 1b\n\t"
+			       /* Store a, b, c, d, and e */
+			       "pshufd $0x1b, %%xmm0, %%xmm0\n\t"
+			       "movdqu %%xmm0, (%2)\n\t"
+			       "psrldq $12, %%xmm1\n\t"
+			       "movd %%xmm1, 16(%2)\n\t"
+			       : "+r" ( data ), "+r" ( count )
+			       : "r" ( digest ), "m" ( sha1_ni_mask )
+			       : "xmm0", "xmm1", "xmm2", "xmm3", "xmm4",
+				 "xmm5", "xmm6", "xmm7", "xmm8", "xmm9",
+				 "memory" );
 }
 
-/** An SHA-1 step function */
-struct sha1_step {
-	/**
-	 * Calculate f(a,b,c,d)
-	 *
-	 * @v v		SHA-1 variables
-	 * @ret f	f(a,b,c,d)
-	 */
-	uint32_t ( * f ) ( struct sha1_variables *v );
-	/** Constant k */
-	uint32_t k;
-};
+#endif /* __x86_64__ */
+
+#ifdef __aarch64__
 
-/** SHA-1 steps */
-static struct sha1_step sha1_steps[4] = {
-	/** 0 to 19 */
-	{ .f = sha1_f_0_19,		.k = 0x5a827999 },
-	/** 20 to 39 */
-	{ .f = sha1_f_20_39_60_79,	.k = 0x6ed9eba1 },
-	/** 40 to 59 */
-	{ .f = sha1_f_40_59,		.k = 0x8f1bbcdc },
-	/** 60 to 79 */
-	{ .f = sha1_f_20_39_60_79,	.k = 0xca62c1d6 },
+/** Get SHA1 field from ID_AA64ISAR0_EL1 */
+#define SHA1_ISAR0_SHA1( isar0 ) ( ( (isar0) >> 8 ) & 0xf )
+
+/** Constants k for each group of twenty steps */
+static const uint32_t sha1_ce_k[4] = {
+	SHA1_K_0_19, SHA1_K_20_39, SHA1_K_40_59, SHA1_K_60_79,
 };
 
 /**
- * Initialise SHA-1 algorithm
+ * Perform four SHA-1 steps using SHA1 instructions
  *
- * @v ctx		SHA-1 context
+ * Register v0 holds a, b, c, and d.  Registers v1 and v2 alternately
+ * hold e and receive the value of e for the following four steps.
+ * Registers v16 to v19 hold the constants k.
  */
-void sha1_init ( void *ctx ) {
-	struct sha1_context *context = ctx;
+#define SHA1_CE_STEP4( op, e, next, w, k )				\
+	"add v22.4s, v" #w ".4s, v" #k ".4s\n\t"			\
+	"sha1h s" #next ", s0\n\t"					\
+	"sha1" #op " q0, s" #e ", v22.4s\n\t"
 
-	context->ddd.dd.digest.h[0] = cpu_to_be32 ( 0x67452301 );
-	context->ddd.dd.digest.h[1] = cpu_to_be32 ( 0xefcdab89 );
-	context->ddd.dd.digest.h[2] = cpu_to_be32 ( 0x98badcfe );
-	context->ddd.dd.digest.h[3] = cpu_to_be32 ( 0x10325476 );
-	context->ddd.dd.digest.h[4] = cpu_to_be32 ( 0xc3d2e1f0 );
-	context->len = 0;
+/** Convert four message schedule words to host byte order */
+#define SHA1_CE_SWAP( w )						\
+	"rev32 v" #w ".16b, v" #w ".16b\n\t"
+
+/**
+ * Calculate message schedule words using SHA1 instructions
+ *
+ * Registers v4 to v7 hold a sliding window of sixteen message
+ * schedule words, with each set of four words being replaced by the
+ * set of four words sixteen steps later.
+ */
+#define SHA1_CE_MSG( w, x, y, z )					\
+	"sha1su0 v" #w ".4s, v" #x ".4s, v" #y ".4s\n\t"		\
+	"sha1su1 v" #w ".4s, v" #z ".4s\n\t"
+
+/** Perform four SHA-1 steps and advance message schedule */
+#define SHA1_CE_STEP4_MSG( op, e, next, w, x, y, z, k )			\
+	SHA1_CE_MSG ( w, x, y, z )					\
+	SHA1_CE_STEP4 ( op, e, next, w, k )
+
+/**
+ * Check for SHA1 instructions
+ *
+ * @ret supported	SHA1 instructions are supported on this CPU
+ */
+static int sha1_ce_supported ( void ) {
+	uint64_t isar0;
+
+	/* Check for SHA1 instructions */
+	__asm__ ( "mrs %0, ID_AA64ISAR0_EL1\n\t" : "=r" ( isar0 ) );
+	return ( SHA1_ISAR0_SHA1 ( isar0 ) != 0 );
 }
 
 /**
- * Calculate SHA-1 digest of accumulated data
- *
- * @v context		SHA-1 context
- */
-static void sha1_digest ( struct sha1_context *context ) {
-        union {
-		union sha1_digest_data_dwords ddd;
-		struct sha1_variables v;
-	} u;
-	uint32_t *a = &u.v.a;
-	uint32_t *b = &u.v.b;
-	uint32_t *c = &u.v.c;
-	uint32_t *d = &u.v.d;
-	uint32_t *e = &u.v.e;
-	uint32_t *w = u.v.w;
-	uint32_t f;
-	uint32_t k;
-	uint32_t temp;
-	struct sha1_step *step;
-	unsigned int i;
+ * Calculate SHA-1 digest of data blocks using SHA1 instructions
+ *
+ * @v digest		Digest of data already processed (host-endian)
+ * @v data		Data blocks
+ * @v count		Number of data blocks (must be non-zero)
+ */
+static void sha1_blocks_ce ( struct sha1_digest *digest, const void *data,
+			     size_t count ) {
 
-	/* Convert h[0..4] to host-endian, and initialise a, b, c, d,
-	 * e, and w[0..15]
-	 */
-	for ( i = 0 ; i < ( sizeof ( u.ddd.dword ) /
-			    sizeof ( u.ddd.dword[0] ) ) ; i++ ) {
-		be32_to_cpus ( &context->ddd.dword[i] );
-		u.ddd.dword[i] = context->ddd.dword[i];
-	}
+	__asm__ __volatile__ ( ".arch_extension sha2\n\t"
+			       /* Load a, b, c, d, e, and constants */
+			       "ld1 { v0.4s }, [%2]\n\t"
+			       "ldr s1, [%2, #16]\n\t"
+			       "ld4r { v16.4s, v17.4s, v18.4s, v19.4s }, "
+			       "[%3]\n\t"
+			       "\n1:\n\t"
+			       /* Record digest of data already processed */
+			       "mov v20.16b, v0.16b\n\t"
+			       "mov v21.16b, v1.16b\n\t"
+			       /* Load message schedule */
+			       "ld1 { v4.16b, v5.16b, v6.16b, v7.16b }, "
+			       "[%0], #64\n\t"
+			       SHA1_CE_SWAP ( 4 )
+			       SHA1_CE_SWAP ( 5 )
+			       SHA1_CE_SWAP ( 6 )
+			       SHA1_CE_SWAP ( 7 )
+			       /* Steps 0 to 19 */
+			       SHA1_CE_STEP4 ( c, 1, 2, 4, 16 )
+			       SHA1_CE_STEP4 ( c, 2, 1, 5, 16 )
+			       SHA1_CE_STEP4 ( c, 1, 2, 6, 16 )
+			       SHA1_CE_STEP4 ( c, 2, 1, 7, 16 )
+			       SHA1_CE_STEP4_MSG ( c, 1, 2, 4, 5, 6, 7, 16 )
+			       /* Steps 20 to 39 */
+			       SHA1_CE_STEP4_MSG ( p, 2, 1, 5, 6, 7, 4, 17 )
+			       SHA1_CE_STEP4_MSG ( p, 1, 2, 6, 7, 4, 5, 17 )
+			       SHA1_CE_STEP4_MSG ( p, 2, 1, 7, 4, 5, 6, 17 )
+			       SHA1_CE_STEP4_MSG ( p, 1, 2, 4, 5, 6, 7, 17 )
+			       SHA1_CE_STEP4_MSG ( p, 2, 1, 5, 6, 7, 4, 17 )
+			       /* Steps 40 to 59 */
+			       SHA1_CE_STEP4_MSG ( m, 1, 2, 6, 7, 4, 5, 18 )
+			       SHA1_CE_STEP4_MSG ( m, 2, 1, 7, 4, 5, 6, 18 )
+			       SHA1_CE_STEP4_MSG ( m, 1, 2, 4, 5, 6, 7, 18 )
+			       SHA1_CE_STEP4_MSG ( m, 2, 1, 5, 6, 7, 4, 18 )
+			       SHA1_CE_STEP4_MSG ( m, 1, 2, 6, 7, 4, 5, 18 )
+			       /* Steps 60 to 79 */
+			       SHA1_CE_STEP4_MSG ( p, 2, 1, 7, 4, 5, 6, 19 )
+			       SHA1_CE_STEP4_MSG ( p, 1, 2, 4, 5, 6, 7, 19 )
+			       SHA1_CE_STEP4_MSG ( p, 2, 1, 5, 6, 7, 4, 19 )
+			       SHA1_CE_STEP4_MSG ( p, 1, 2, 6, 7, 4, 5, 19 )
+			       SHA1_CE_STEP4_MSG ( p, 2, 1, 7, 4, 5, 6, 19 )
+			       /* Add block to hash */
+			       "add v0.4s, v0.4s, v20.4s\n\t"
+			       "add v1.4s, v1.4s, v21.4s\n\t"
+			       "subs %1, %1, #1\n\t"
+			       "b.ne 1b\n\t"
+			       /* Store a, b, c, d, and e */
+			       "st1 { v0.4s }, [%2]\n\t"
+			       "str s1, [%2, #16]\n\t"
+			       : "+r" ( data ), "+r" ( count )
+			       : "r" ( digest ), "r" ( sha1_ce_k )
+			       : "v0", "v1", "v2", "v4", "v5", "v6", "v7",
+				 "v16", "v17", "v18", "v19", "v20", "v21",
+				 "v22", "cc", "memory" );
+}
+
+#endif /* __aarch64__ */
 
-	/* Initialise w[16..79] */
-	for ( i = 16 ; i < 80 ; i++ )
-		w[i] = rol32 ( ( w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16] ), 1 );
-
-	/* Main loop */
-	for ( i = 0 ; i < 80 ; i++ ) {
-		step = &sha1_steps[ i / 20 ];
-		f = step->f ( &u.v );
-		k = step->k;
-		temp = ( rol32 ( *a, 5 ) + f + *e + k + w[i] );
-		*e = *d;
-		*d = *c;
-		*c = rol32 ( *b, 30 );
-		*b = *a;
-		*a = temp;
+/**
+ * Calculate SHA-1 digest of data blocks
+ *
+ * @v digest		Digest of data already processed (host-endian)
+ * @v data		Data blocks
+ * @v count		Number of data blocks
+ */
+static void sha1_blocks ( struct sha1_digest *digest, const void *data,
+			  size_t count ) {
+#ifdef __x86_64__
+	static int sha1_ni = -1;
+
+	/* Use SHA extensions, if available */
+	if ( sha1_ni < 0 ) {
+		sha1_ni = sha1_ni_supported();
+		DBG2 ( "SHA-1 %s SHA extensions\n",
+		       ( sha1_ni ? "using" : "not using" ) );
 	}
+	if ( sha1_ni && count ) {
+		sha1_blocks_ni ( digest, data, count );
+		return;
+	}
+#endif
+#ifdef __aarch64__
+	static int sha1_ce = -1;
 
-	/* Add chunk to hash and convert back to big-endian */
-	for ( i = 0 ; i < 5 ; i++ ) {
-		context->ddd.dd.digest.h[i] =
-			cpu_to_be32 ( context->ddd.dd.digest.h[i] +
-				      u.ddd.dd.digest.h[i] );
+	/* Use SHA1 instructions, if available */
+	if ( sha1_ce < 0 ) {
+		sha1_ce = sha1_ce_supported();
+		DBG2 ( "SHA-1 %s SHA1 instructions\n",
+		       ( sha1_ce ? "using" : "not using" ) );
+	}
+	if ( sha1_ce && count ) {
+		sha1_blocks_ce ( digest, data, count );
+		return;
 	}
+#endif
+
+	sha1_blocks_generic ( digest, data, count );
+}
+
+/**
+ * Initialise SHA-1 algorithm
+ *
+ * @v ctx		SHA-1 context
+ */
+void sha1_init ( void *ctx ) {
+	struct sha1_context *context = ctx;
+
+	context->ddd.dd.digest.h[0] = 0x67452301;
+	context->ddd.dd.digest.h[1] = 0xefcdab89;
+	context->ddd.dd.digest.h[2] = 0x98badcfe;
+	context->ddd.dd.digest.h[3] = 0x10325476;
+	context->ddd.dd.digest.h[4] = 0xc3d2e1f0;
+	context->len = 0;
 }
 
 /**
@@ -185,19 +508,35 @@ static void sha1_digest ( struct sha1_context *context ) {
  */
 void sha1_update ( void *ctx, const void *data, size_t len ) {
 	struct sha1_context *context = ctx;
+	union sha1_block *block = &context->ddd.dd.data;
 	const uint8_t *byte = data;
 	size_t offset;
+	size_t frag_len;
+	size_t count;
 
-	/* Accumulate data a byte at a time, performing the digest
-	 * whenever we fill the data buffer
-	 */
-	while ( len-- ) {
-		offset = ( context->len % sizeof ( context->ddd.dd.data ) );
-		context->ddd.dd.data.byte[offset] = *(byte++);
-		context->len++;
-		if ( ( context->len % sizeof ( context->ddd.dd.data ) ) == 0 )
-			sha1_digest ( context );
+	/* Fill any partially accumulated data block */
+	offset = ( context->len % sizeof ( *block ) );
+	context->len += len;
+	if ( offset ) {
+		frag_len = ( sizeof ( *block ) - offset );
+		if ( frag_len > len ) {
+			memcpy ( &block->byte[offset], byte, len );
+			return;
+		}
+		memcpy ( &block->byte[offset], byte, frag_len );
+		sha1_blocks ( &context->ddd.dd.digest, block, 1 );
+		byte += frag_len;
+		len -= frag_len;
 	}
+
+	/* Digest whole blocks directly from the input data */
+	count = ( len / sizeof ( *block ) );
+	sha1_blocks ( &context->ddd.dd.digest, byte, count );
+	byte += ( count * sizeof ( *block ) );
+	len -= ( count * sizeof ( *block ) );
+
+	/* Accumulate any remaining data */
+	memcpy ( block->byte, byte, len );
 }
 
 /**
@@ -208,25 +547,30 @@ void sha1_update ( void *ctx, const void *data, size_t len ) {
  */
 void sha1_final ( void *ctx, void *out ) {
 	struct sha1_context *context = ctx;
-	uint64_t len_bits;
-	uint8_t pad;
-
-	/* Record length before pre-processing */
-	len_bits = cpu_to_be64 ( ( ( uint64_t ) context->len ) * 8 );
+	union sha1_block *block = &context->ddd.dd.data;
+	struct sha1_digest *digest = &context->ddd.dd.digest;
+	size_t offset;
+	unsigned int i;
 
 	/* Pad with a single "1" bit followed by as many "0" bits as required */
-	pad = 0x80;
-	do {
-		sha1_update ( ctx, &pad, sizeof ( pad ) );
-		pad = 0x00;
-	} while ( ( context->len % sizeof ( context->ddd.dd.data ) ) !=
-		  offsetof ( typeof ( context->ddd.dd.data ), final.len ) );
+	offset = ( context->len % sizeof ( *block ) );
+	block->byte[offset++] = 0x80;
+	if ( offset > offsetof ( typeof ( *block ), final.len ) ) {
+		memset ( &block->byte[offset], 0, ( sizeof ( *block ) - offset ) );
+		sha1_blocks ( digest, block, 1 );
+		offset = 0;
+	}
+	memset ( &block->byte[offset], 0,
+		 ( offsetof ( typeof ( *block ), final.len ) - offset ) );
 
 	/* Append length (in bits) */
-	sha1_update ( ctx, &len_bits, sizeof ( len_bits ) );
-	assert ( ( context->len % sizeof ( context->ddd.dd.data ) ) == 0 );
+	block->final.len = cpu_to_be64 ( ( ( uint64_t ) context->len ) * 8 );
+	sha1_blocks ( digest, block, 1 );
 
 	/* Copy out final digest */
-	memcpy ( out, &context->ddd.dd.digest,
-		 sizeof ( context->ddd.dd.digest ) );
+	for ( i = 0 ; i < ( sizeof ( digest->h ) / sizeof ( digest->h[0] ) ) ;
+	      i++ ) {
+		cpu_to_be32s ( &digest->h[i] );
+	}
+	memcpy ( out, digest, sizeof ( *digest ) );
 }
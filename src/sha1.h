@@ -36,7 +36,7 @@ union sha1_block {
  * code size.
  */
 struct sha1_digest_data {
-	/** Digest of data already processed */
+	/** Digest of data already processed (host-endian) */
 	struct sha1_digest digest;
 	/** Accumulated data */
 	union sha1_block data;
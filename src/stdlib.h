@@ -27,6 +27,10 @@
  *
  */
 
+#include <stdint.h>
+
 extern unsigned long strtoul ( const char *nptr, char **endptr, int base );
+extern void * malloc ( size_t size );
+extern void free ( void *ptr );
 
 #endif /* _STDLIB_H */
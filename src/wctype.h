@@ -46,6 +46,10 @@ static inline int towupper ( wint_t c ) {
 	return toupper ( c );
 }
 
+static inline int towlower ( wint_t c ) {
+	return tolower ( c );
+}
+
 static inline int iswspace ( wint_t c ) {
 	return isspace ( c );
 }
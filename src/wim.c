@@ -25,19 +25,111 @@
  */
 
 #include <stddef.h>
+#include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <wchar.h>
+#include <wctype.h>
 #include <assert.h>
 #include "wimboot.h"
 #include "vdisk.h"
 #include "lzx.h"
 #include "xca.h"
+#include "lzms.h"
+#include "malloc.h"
 #include "wim.h"
 
 /** WIM chunk buffer */
 static struct wim_chunk_buffer wim_chunk_buffer;
 
+/** WIM chunk cache
+ *
+ * The first entry uses the static chunk buffer unless a larger
+ * buffer is required.  Buffers for the remaining entries are
+ * allocated as needed, and the cache is simply limited to the
+ * allocated entries if memory runs out.
+ */
+static struct wim_cached_chunk wim_cache[WIM_CACHE_MAX];
+
+/** WIM solid resource chunk cache
+ *
+ * Solid resource chunks are typically far larger than other chunks
+ * (and frequently far larger than the heap), and so are cached
+ * separately in a single dedicated buffer reserved from the platform.
+ * This is reserved when solid resources are indexed, or when a
+ * packed stream is first read if the platform allows memory to be
+ * reserved at any time.
+ */
+static struct wim_cached_chunk wim_solid_cache;
+
+/** WIM solid resource compressed chunk buffer
+ *
+ * This is reserved along with (and has the same length as) the
+ * solid resource chunk cache buffer.
+ */
+static uint8_t *wim_solid_data;
+
+/** A partially decoded WIM chunk */
+struct wim_partial {
+	/** Cache entry being decoded, or NULL */
+	struct wim_cached_chunk *cached;
+	/** Length of compressed data buffer */
+	size_t len;
+	/** Length of LZX decompression buffer */
+	size_t window_len;
+	/** Compressed data, or NULL if not yet allocated */
+	uint8_t *data;
+	/** LZX decompression buffer
+	 *
+	 * LZX matches must copy data from prior to E8 jump
+	 * translation, and so decompression cannot take place within
+	 * the cache entry's own buffer.
+	 */
+	uint8_t *window;
+	/** Decompressor */
+	union {
+		/** LZX decompressor */
+		struct lzx lzx;
+		/** XCA decompressor */
+		struct xca xca;
+	} decompressor;
+};
+
+/** Partially decoded WIM chunk */
+static struct wim_partial wim_partial;
+
+/** Number of usable WIM chunk cache entries */
+static unsigned int wim_cache_count = WIM_CACHE_MAX;
+
+/** WIM chunk offset table cache */
+static struct wim_chunk_table wim_tables[WIM_TABLE_CACHE];
+
+/** WIM lookup table index cache */
+static struct wim_lookup_index wim_indices[WIM_INDEX_CACHE];
+
+/** WIM directory tree cache */
+static struct wim_dir_tree wim_trees[WIM_TREE_CACHE];
+
+/** WIM resource access streams */
+static struct wim_stream wim_streams[WIM_STREAM_MAX];
+
+/** WIM chunk cache usage counter */
+static unsigned long wim_cache_ticks;
+
+/** Number of WIM chunk cache hits */
+static unsigned long wim_cache_hits;
+
+/** Number of WIM chunk cache misses */
+static unsigned long wim_cache_misses;
+
+/** WIM header compression flags for each solid resource compression format */
+static const uint32_t wim_solid_flags[] = {
+	[WIM_SOLID_NONE] = 0,
+	[WIM_SOLID_XPRESS] = WIM_HDR_XPRESS,
+	[WIM_SOLID_LZX] = WIM_HDR_LZX,
+	[WIM_SOLID_LZMS] = WIM_HDR_LZMS,
+};
+
 /**
  * Get WIM header
  *
@@ -59,16 +151,149 @@ int wim_header ( struct vdisk_file *file, struct wim_header *header ) {
 	return 0;
 }
 
+/**
+ * Get chunk length
+ *
+ * @v header		WIM header
+ * @ret chunk_len	Chunk length
+ */
+static inline size_t wim_chunk_size ( struct wim_header *header ) {
+
+	return ( header->chunk_len ? header->chunk_len : WIM_CHUNK_LEN );
+}
+
+/**
+ * Get LZX window size
+ *
+ * @v header		WIM header
+ * @ret window		LZX window size
+ *
+ * LZX chunks smaller than the minimum LZX window size are decoded
+ * using the minimum window size.
+ */
+static inline size_t wim_lzx_window ( struct wim_header *header ) {
+	size_t chunk_len = wim_chunk_size ( header );
+
+	return ( ( chunk_len < LZX_MIN_WINDOW ) ? LZX_MIN_WINDOW : chunk_len );
+}
+
+/**
+ * Check chunk length against compression format limits
+ *
+ * @v flags		WIM header compression flags
+ * @v chunk_len		Chunk length
+ * @ret supported	Chunk length is supported
+ */
+static int wim_chunk_supported ( uint32_t flags, size_t chunk_len ) {
+
+	/* XPRESS chunks never exceed a single XPRESS block */
+	if ( ( flags & WIM_HDR_XPRESS ) && ( chunk_len > XCA_BLOCK_SIZE ) )
+		return 0;
+
+	return 1;
+}
+
+/**
+ * Get number of chunks in a compressed resource
+ *
+ * @v header		WIM header
+ * @v resource		Resource
+ * @ret chunks		Number of chunks
+ *
+ * The chunk length must already have been validated as a power of
+ * two.
+ */
+static unsigned int wim_chunks ( struct wim_header *header,
+				 struct wim_resource_header *resource ) {
+	size_t chunk_len = wim_chunk_size ( header );
+
+	return ( ( resource->len + chunk_len - 1 ) >>
+		 __builtin_ctz ( chunk_len ) );
+}
+
+/**
+ * Get chunk offset table
+ *
+ * @v file		Virtual file
+ * @v resource		Resource
+ * @v len		Length of chunk offset table
+ * @ret offsets		Raw chunk offsets, or NULL if not available
+ *
+ * The chunk offset table for a resource is read in its entirety the
+ * first time that the resource is accessed, to avoid the need to
+ * read each individual chunk offset from the underlying file.
+ *
+ * A solid resource records the compressed length of each chunk
+ * rather than the offset of each subsequent chunk.  The lengths are
+ * converted to 32-bit offsets of each subsequent chunk, so that the
+ * cached table may be used in the same way as any other.  (Any
+ * offsets that overflow are caught by the usual sanity checks on
+ * each chunk's offset and length.)
+ */
+static void * wim_chunk_table ( struct vdisk_file *file,
+				struct wim_resource_header *resource,
+				size_t len ) {
+	struct wim_chunk_table *table;
+	struct wim_chunk_table *victim = NULL;
+	uint32_t *offsets;
+	unsigned int i;
+
+	/* Look for a cached copy of this table, and identify the
+	 * least recently used entry in case there is none.
+	 */
+	for ( i = 0 ; i < WIM_TABLE_CACHE ; i++ ) {
+		table = &wim_tables[i];
+		if ( ( table->file == file ) &&
+		     ( table->resource_offset == resource->offset ) ) {
+			table->used = ++wim_cache_ticks;
+			return table->offsets;
+		}
+		if ( ( ! victim ) || ( table->used < victim->used ) )
+			victim = table;
+	}
+
+	/* Do not cache (or evict any existing table for) an oversized
+	 * table
+	 */
+	if ( len > WIM_TABLE_MAX_LEN )
+		return NULL;
+
+	/* Allocate table, replacing the victim only on success */
+	offsets = malloc ( len );
+	if ( ! offsets )
+		return NULL;
+	free ( victim->offsets );
+	victim->offsets = offsets;
+
+	/* Read table */
+	file->read ( file, offsets, resource->offset, len );
+
+	/* Convert solid resource chunk lengths to offsets */
+	if ( resource->zlen__flags & WIM_RESHDR_PACKED_STREAMS ) {
+		for ( i = 1 ; i < ( len / sizeof ( offsets[0] ) ) ; i++ )
+			offsets[i] += offsets[ i - 1 ];
+	}
+	victim->file = file;
+	victim->resource_offset = resource->offset;
+	victim->used = ++wim_cache_ticks;
+	DBG2 ( "...cached %s %#llx chunk table\n",
+	       file->name, resource->offset );
+
+	return victim->offsets;
+}
+
 /**
  * Get compressed chunk offset
  *
  * @v file		Virtual file
+ * @v header		WIM header
  * @v resource		Resource
  * @v chunk		Chunk number
  * @v offset		Offset to fill in
  * @ret rc		Return status code
  */
 static int wim_chunk_offset ( struct vdisk_file *file,
+			      struct wim_header *header,
 			      struct wim_resource_header *resource,
 			      unsigned int chunk, size_t *offset ) {
 	size_t zlen = ( resource->zlen__flags & WIM_RESHDR_ZLEN_MASK );
@@ -76,6 +301,7 @@ static int wim_chunk_offset ( struct vdisk_file *file,
 	size_t offset_offset;
 	size_t offset_len;
 	size_t chunks_len;
+	void *offsets;
 	union {
 		uint32_t offset_32;
 		uint64_t offset_64;
@@ -87,11 +313,19 @@ static int wim_chunk_offset ( struct vdisk_file *file,
 		return 0;
 	}
 
-	/* Calculate chunk parameters */
-	chunks = ( ( resource->len + WIM_CHUNK_LEN - 1 ) / WIM_CHUNK_LEN );
-	offset_len = ( ( resource->len > 0xffffffffULL ) ?
-		       sizeof ( u.offset_64 ) : sizeof ( u.offset_32 ) );
-	chunks_len = ( ( chunks - 1 ) * offset_len );
+	/* Calculate chunk parameters.  A solid resource records a
+	 * 32-bit length for every chunk, including chunk 0.
+	 */
+	chunks = wim_chunks ( header, resource );
+	if ( resource->zlen__flags & WIM_RESHDR_PACKED_STREAMS ) {
+		offset_len = sizeof ( u.offset_32 );
+		chunks_len = ( chunks * offset_len );
+	} else {
+		offset_len = ( ( resource->len > 0xffffffffULL ) ?
+			       sizeof ( u.offset_64 ) :
+			       sizeof ( u.offset_32 ) );
+		chunks_len = ( ( chunks - 1 ) * offset_len );
+	}
 
 	/* Sanity check */
 	if ( chunks_len > zlen ) {
@@ -114,10 +348,22 @@ static int wim_chunk_offset ( struct vdisk_file *file,
 		return 0;
 	}
 
-	/* Otherwise, read the chunk offset */
+	/* Otherwise, get the chunk offset from the cached table if
+	 * possible, falling back to reading it from the file (which is
+	 * not possible for a solid resource).
+	 */
 	offset_offset = ( ( chunk - 1 ) * offset_len );
-	file->read ( file, &u, ( resource->offset + offset_offset ),
-		     offset_len );
+	offsets = wim_chunk_table ( file, resource, chunks_len );
+	if ( offsets ) {
+		memcpy ( &u, ( offsets + offset_offset ), offset_len );
+	} else if ( resource->zlen__flags & WIM_RESHDR_PACKED_STREAMS ) {
+		DBG ( "Could not get solid resource %#llx chunk table\n",
+		      resource->offset );
+		return -1;
+	} else {
+		file->read ( file, &u, ( resource->offset + offset_offset ),
+			     offset_len );
+	}
 	*offset = ( chunks_len + ( ( offset_len == sizeof ( u.offset_64 ) ) ?
 				   u.offset_64 : u.offset_32 ) );
 	if ( *offset > zlen ) {
@@ -127,6 +373,150 @@ static int wim_chunk_offset ( struct vdisk_file *file,
 	return 0;
 }
 
+/**
+ * Get uncompressed chunk length
+ *
+ * @v header		WIM header
+ * @v resource		Resource
+ * @v chunk		Chunk number
+ * @ret len		Uncompressed length
+ */
+static size_t wim_chunk_len ( struct wim_header *header,
+			      struct wim_resource_header *resource,
+			      unsigned int chunk ) {
+	unsigned int chunks;
+	size_t len;
+
+	/* All chunks except the last are full-length */
+	assert ( resource->len > 0 );
+	chunks = wim_chunks ( header, resource );
+	len = wim_chunk_size ( header );
+	if ( chunk >= ( chunks - 1 ) )
+		len -= ( -resource->len & ( len - 1 ) );
+	return len;
+}
+
+/**
+ * Unpack chunk from raw chunk data
+ *
+ * @v header		WIM header
+ * @v resource		Resource
+ * @v chunk		Chunk number
+ * @v data		Raw (possibly compressed) chunk data
+ * @v len		Length of raw chunk data
+ * @v buf		Output buffer
+ * @ret rc		Return status code
+ */
+static int wim_unpack ( struct wim_header *header,
+			struct wim_resource_header *resource,
+			unsigned int chunk, const void *data, size_t len,
+			void *buf ) {
+	size_t expected_out_len;
+	ssize_t out_len;
+
+	/* Copy data directly if chunk did not compress */
+	expected_out_len = wim_chunk_len ( header, resource, chunk );
+	if ( len == expected_out_len ) {
+		memcpy ( buf, data, len );
+		return 0;
+	}
+
+	/* Decompress data directly into output buffer */
+	if ( header->flags & WIM_HDR_LZX ) {
+		out_len = lzx_decompress_window ( data, len, buf,
+						  expected_out_len,
+						  wim_lzx_window ( header ) );
+	} else if ( header->flags & WIM_HDR_XPRESS ) {
+		out_len = xca_decompress ( data, len, buf, expected_out_len );
+	} else if ( header->flags & WIM_HDR_LZMS ) {
+		out_len = lzms_decompress ( data, len, buf, expected_out_len );
+	} else {
+		DBG ( "Can't handle unknown compression scheme %#08x "
+		      "for %#llx chunk %d\n", header->flags,
+		      resource->offset, chunk );
+		return -1;
+	}
+	if ( out_len < 0 )
+		return out_len;
+	if ( ( ( size_t ) out_len ) != expected_out_len ) {
+		DBG ( "Unexpected output length %#lx (expected %#zx)\n",
+		      out_len, expected_out_len );
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Allocate partial decoding buffers
+ *
+ * @v len		Compressed data length
+ * @v window_len	LZX decompression buffer length (or zero)
+ * @ret rc		Return status code
+ *
+ * Any partially decoded chunk is abandoned if the buffers must be
+ * reallocated.
+ */
+static int wim_partial_alloc ( size_t len, size_t window_len ) {
+	struct wim_partial *partial = &wim_partial;
+
+	/* Do nothing if existing buffers are large enough */
+	if ( ( partial->len >= len ) && ( partial->window_len >= window_len ) )
+		return 0;
+
+	/* Reallocate buffers, retaining existing buffer lengths */
+	if ( len < partial->len )
+		len = partial->len;
+	if ( window_len < partial->window_len )
+		window_len = partial->window_len;
+	partial->cached = NULL;
+	free ( partial->data );
+	partial->data = malloc ( len + window_len );
+	if ( ! partial->data ) {
+		partial->len = 0;
+		partial->window_len = 0;
+		return -1;
+	}
+	partial->window = ( partial->data + len );
+	partial->len = len;
+	partial->window_len = window_len;
+
+	return 0;
+}
+
+/**
+ * Reserve solid resource chunk buffers
+ *
+ * @v len		Chunk length
+ * @ret rc		Return status code
+ *
+ * Buffers are reserved at most once, since memory reserved from the
+ * platform cannot be freed.
+ */
+static int wim_solid_reserve ( size_t len ) {
+	struct wim_cached_chunk *cached = &wim_solid_cache;
+	uint8_t *buf;
+
+	/* Do nothing if existing buffers are large enough */
+	if ( cached->buf_len >= len )
+		return 0;
+
+	/* Reserve chunk cache buffer and compressed data buffer,
+	 * never abandoning any existing (smaller) buffers
+	 */
+	if ( cached->buf || ( ! mreserve ) ||
+	     ( ! ( buf = mreserve ( 2 * len ) ) ) ) {
+		DBG ( "No %#zx-byte WIM solid chunk buffer\n", len );
+		return -1;
+	}
+	cached->file = NULL;
+	cached->buf = buf;
+	cached->buf_len = len;
+	wim_solid_data = ( buf + len );
+
+	return 0;
+}
+
 /**
  * Read chunk from a compressed resource
  *
@@ -134,155 +524,1093 @@ static int wim_chunk_offset ( struct vdisk_file *file,
  * @v header		WIM header
  * @v resource		Resource
  * @v chunk		Chunk number
- * @v buf		Chunk buffer
+ * @v buf		Output buffer
  * @ret rc		Return status code
+ *
+ * The output buffer must be large enough to hold the uncompressed
+ * chunk, and may be either a chunk buffer or the caller's own buffer.
  */
 static int wim_chunk ( struct vdisk_file *file, struct wim_header *header,
 		       struct wim_resource_header *resource,
-		       unsigned int chunk, struct wim_chunk_buffer *buf ) {
-	ssize_t ( * decompress ) ( const void *data, size_t len, void *buf );
-	unsigned int chunks;
+		       unsigned int chunk, void *buf ) {
 	size_t offset;
 	size_t next_offset;
 	size_t len;
-	size_t expected_out_len;
-	ssize_t out_len;
 	int rc;
 
 	/* Get chunk compressed data offset and length */
-	if ( ( rc = wim_chunk_offset ( file, resource, chunk,
+	if ( ( rc = wim_chunk_offset ( file, header, resource, chunk,
 				       &offset ) ) != 0 )
 		return rc;
-	if ( ( rc = wim_chunk_offset ( file, resource, ( chunk + 1 ),
-				       &next_offset ) ) != 0 )
+	if ( ( rc = wim_chunk_offset ( file, header, resource,
+				       ( chunk + 1 ), &next_offset ) ) != 0 )
 		return rc;
 	len = ( next_offset - offset );
 
-	/* Calculate uncompressed length */
-	assert ( resource->len > 0 );
-	chunks = ( ( resource->len + WIM_CHUNK_LEN - 1 ) / WIM_CHUNK_LEN );
-	expected_out_len = WIM_CHUNK_LEN;
-	if ( chunk >= ( chunks - 1 ) )
-		expected_out_len -= ( -resource->len & ( WIM_CHUNK_LEN - 1 ) );
-
 	/* Read possibly-compressed data */
-	if ( len == expected_out_len ) {
+	if ( len == wim_chunk_len ( header, resource, chunk ) ) {
 
 		/* Chunk did not compress; read raw data */
-		file->read ( file, buf->data, ( resource->offset + offset ),
+		file->read ( file, buf, ( resource->offset + offset ),
 			     len );
+		return 0;
 
-	} else {
+	} else if ( len <= WIM_CHUNK_LEN ) {
 		uint8_t zbuf[len];
 
 		/* Read compressed data into a temporary buffer */
 		file->read ( file, zbuf, ( resource->offset + offset ), len );
 
-		/* Identify decompressor */
-		if ( header->flags & WIM_HDR_LZX ) {
-			decompress = lzx_decompress;
-		} else if ( header->flags & WIM_HDR_XPRESS ) {
-			decompress = xca_decompress;
+		/* Unpack chunk */
+		return wim_unpack ( header, resource, chunk, zbuf, len, buf );
+
+	} else if ( resource->zlen__flags & WIM_RESHDR_PACKED_STREAMS ) {
+
+		/* Read compressed data into the reserved solid resource
+		 * compressed chunk buffer, since it is too large for
+		 * the stack (or, typically, the heap).
+		 */
+		if ( len > wim_solid_cache.buf_len ) {
+			DBG ( "No %#zx-byte WIM solid chunk buffer\n", len );
+			return -1;
+		}
+		file->read ( file, wim_solid_data,
+			     ( resource->offset + offset ), len );
+
+		/* Unpack chunk */
+		return wim_unpack ( header, resource, chunk, wim_solid_data,
+				    len, buf );
+
+	} else {
+
+		/* Read compressed data into the (otherwise idle) partial
+		 * decoding buffer, since it is too large for the stack.
+		 */
+		if ( ( rc = wim_partial_alloc ( len, 0 ) ) != 0 ) {
+			DBG ( "Could not allocate %#zx-byte chunk buffer\n",
+			      len );
+			return rc;
+		}
+		wim_partial.cached = NULL;
+		file->read ( file, wim_partial.data,
+			     ( resource->offset + offset ), len );
+
+		/* Unpack chunk */
+		return wim_unpack ( header, resource, chunk, wim_partial.data,
+				    len, buf );
+	}
+}
+
+/**
+ * Decode chunk into cache entry
+ *
+ * @v file		Virtual file
+ * @v header		WIM header
+ * @v resource		Resource
+ * @v cached		Cache entry
+ * @v need		Length of decoded data required
+ * @ret rc		Return status code
+ *
+ * Where possible, only as much of a compressed chunk as is required
+ * is decoded, and the decompressor state is retained so that
+ * decoding can be resumed if more of the same chunk is subsequently
+ * required.  Only one chunk may be partially decoded at any time; a
+ * partially decoded chunk that has lost the decompressor state is
+ * simply decoded again from the start.
+ */
+static int wim_decode ( struct vdisk_file *file, struct wim_header *header,
+			struct wim_resource_header *resource,
+			struct wim_cached_chunk *cached, size_t need ) {
+	struct wim_partial *partial = &wim_partial;
+	size_t chunk_len = wim_chunk_len ( header, resource, cached->chunk );
+	size_t offset;
+	size_t next_offset;
+	size_t len;
+	ssize_t out_len;
+	int rc;
+
+	/* Start decoding, unless resuming a partially decoded chunk */
+	if ( ( partial->cached != cached ) || ( ! cached->len ) ) {
+
+		/* Get chunk compressed data offset and length */
+		cached->len = 0;
+		if ( ( rc = wim_chunk_offset ( file, header, resource,
+					       cached->chunk,
+					       &offset ) ) != 0 )
+			return rc;
+		if ( ( rc = wim_chunk_offset ( file, header, resource,
+					       ( cached->chunk + 1 ),
+					       &next_offset ) ) != 0 )
+			return rc;
+		len = ( next_offset - offset );
+
+		/* Decode whole chunk if partial decoding is not
+		 * required or not possible.
+		 */
+		if ( ( need >= chunk_len ) || ( len >= chunk_len ) ||
+		     ( ! ( header->flags & ( WIM_HDR_LZX |
+					     WIM_HDR_XPRESS ) ) ) ||
+		     ( wim_partial_alloc ( chunk_len, chunk_len ) != 0 ) ) {
+			if ( ( rc = wim_chunk ( file, header, resource,
+						cached->chunk,
+						cached->buf ) ) != 0 )
+				return rc;
+			cached->len = chunk_len;
+			return 0;
+		}
+
+		/* Read compressed data and initialise decompressor */
+		partial->cached = NULL;
+		file->read ( file, partial->data, ( resource->offset + offset ),
+			     len );
+		if ( header->flags & WIM_HDR_LZX ) {
+			rc = lzx_init ( &partial->decompressor.lzx,
+					partial->data, len, partial->window,
+					chunk_len, wim_lzx_window ( header ) );
+			if ( rc != 0 )
+				return rc;
+		} else {
+			xca_init ( &partial->decompressor.xca, partial->data,
+				   len, cached->buf, chunk_len );
+		}
+		partial->cached = cached;
+	}
+
+	/* Decode as much as is required */
+	if ( header->flags & WIM_HDR_LZX ) {
+		out_len = lzx_resume ( &partial->decompressor.lzx,
+				       cached->buf, need );
+	} else {
+		out_len = xca_resume ( &partial->decompressor.xca, need );
+	}
+	if ( ( out_len < 0 ) || ( ( ( size_t ) out_len ) < need ) ) {
+		DBG ( "Could not decode %s %#llx chunk %d to %#zx\n",
+		      file->name, resource->offset, cached->chunk, need );
+		partial->cached = NULL;
+		return -1;
+	}
+	DBG2 ( "...decoded %s %#llx chunk %d to %#lx/%#zx\n", file->name,
+	       resource->offset, cached->chunk, out_len, chunk_len );
+
+	/* Release decompressor once chunk is fully decoded */
+	if ( ( ( size_t ) out_len ) >= chunk_len )
+		partial->cached = NULL;
+	cached->len = out_len;
+
+	return 0;
+}
+
+/**
+ * Get number of usable chunk cache entries
+ *
+ * @v header		WIM header
+ * @ret count		Number of usable chunk cache entries
+ *
+ * The cache is limited both to the configured number of chunks and
+ * to a maximum total length, so that large chunks cannot exhaust the
+ * heap.
+ */
+static unsigned int wim_cache_limit ( struct wim_header *header ) {
+	unsigned int count;
+
+	/* Limit cache to the configured number of chunks */
+	if ( wim_cache_count > cmdline_chunks )
+		wim_cache_count = cmdline_chunks;
+
+	/* Limit cache to the maximum total length */
+	count = ( WIM_CACHE_MAX_LEN / wim_chunk_size ( header ) );
+	if ( count > wim_cache_count )
+		count = wim_cache_count;
+
+	return count;
+}
+
+/**
+ * Find chunk in cache
+ *
+ * @v file		Virtual file
+ * @v header		WIM header
+ * @v resource		Resource
+ * @v chunk		Chunk number
+ * @v victim		Least recently used entry to fill in
+ * @ret cached		Cached chunk, or NULL if not cached
+ */
+static struct wim_cached_chunk *
+wim_cache_find ( struct vdisk_file *file, struct wim_header *header,
+		 struct wim_resource_header *resource, unsigned int chunk,
+		 struct wim_cached_chunk **victim ) {
+	struct wim_cached_chunk *cached;
+	unsigned int count;
+	unsigned int i;
+
+	/* Use the dedicated buffer for solid resource chunks */
+	if ( resource->zlen__flags & WIM_RESHDR_PACKED_STREAMS ) {
+		cached = &wim_solid_cache;
+		*victim = cached;
+		if ( ( cached->file == file ) &&
+		     ( cached->resource_offset == resource->offset ) &&
+		     ( cached->chunk == chunk ) ) {
+			return cached;
+		}
+		return NULL;
+	}
+
+	/* Look for a cached copy of this chunk, and identify the
+	 * least recently used entry in case there is none.
+	 */
+	count = wim_cache_limit ( header );
+	*victim = NULL;
+	for ( i = 0 ; i < count ; i++ ) {
+		cached = &wim_cache[i];
+		if ( ( cached->file == file ) &&
+		     ( cached->resource_offset == resource->offset ) &&
+		     ( cached->chunk == chunk ) ) {
+			return cached;
+		}
+		if ( ( ! *victim ) || ( cached->used < (*victim)->used ) )
+			*victim = cached;
+	}
+	return NULL;
+}
+
+/**
+ * Allocate chunk cache entry buffer
+ *
+ * @v victim		Cache entry
+ * @v len		Required buffer length
+ * @ret rc		Return status code
+ *
+ * On failure, the cache is shrunk to exclude the entry (unless it is
+ * the first entry, which reverts to using the static chunk buffer).
+ * The solid resource chunk cache entry's buffer is reserved from the
+ * platform, and is never reallocated.
+ */
+static int wim_cache_alloc ( struct wim_cached_chunk *victim, size_t len ) {
+
+	/* Use static chunk buffer for the first entry initially */
+	if ( ! victim->buf_len && ( victim == wim_cache ) ) {
+		victim->buf = wim_chunk_buffer.data;
+		victim->buf_len = sizeof ( wim_chunk_buffer.data );
+	}
+
+	/* Do nothing if existing buffer is large enough */
+	if ( victim->buf_len >= len )
+		return 0;
+
+	/* Never reallocate the reserved solid resource chunk buffer */
+	if ( victim == &wim_solid_cache ) {
+		DBG ( "No %#zx-byte WIM solid chunk buffer\n", len );
+		return -1;
+	}
+
+	/* Reallocate buffer, shrinking the cache on failure */
+	victim->file = NULL;
+	if ( victim->buf != wim_chunk_buffer.data )
+		free ( victim->buf );
+	victim->buf = malloc ( len );
+	victim->buf_len = len;
+	if ( ! victim->buf ) {
+		if ( victim == wim_cache ) {
+			victim->buf = wim_chunk_buffer.data;
+			victim->buf_len = sizeof ( wim_chunk_buffer.data );
+		} else {
+			victim->buf_len = 0;
+			wim_cache_count = ( victim - wim_cache );
+		}
+		DBG ( "Could not allocate %#zx-byte WIM chunk buffer (cache "
+		      "limited to %d chunks)\n", len, wim_cache_count );
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Get cached chunk from a compressed resource
+ *
+ * @v file		Virtual file
+ * @v header		WIM header
+ * @v resource		Resource
+ * @v chunk		Chunk number
+ * @v need		Length of decoded data required
+ * @ret cached		Cached chunk, or NULL on error
+ */
+static struct wim_cached_chunk *
+wim_cached_chunk ( struct vdisk_file *file, struct wim_header *header,
+		   struct wim_resource_header *resource, unsigned int chunk,
+		   size_t need ) {
+	struct wim_cached_chunk *cached;
+	struct wim_cached_chunk *victim;
+	int rc;
+
+	/* Look for a cached copy of this chunk */
+	cached = wim_cache_find ( file, header, resource, chunk, &victim );
+	if ( cached ) {
+		cached->used = ++wim_cache_ticks;
+		wim_cache_hits++;
+
+		/* Continue decoding chunk, if applicable */
+		if ( ( cached->len < need ) &&
+		     ( ( rc = wim_decode ( file, header, resource, cached,
+					   need ) ) != 0 ) ) {
+			cached->file = NULL;
+			return NULL;
+		}
+		return cached;
+	}
+	wim_cache_misses++;
+	DBG2 ( "...chunk cache miss for %s %#llx chunk %d (%ld hits, "
+	       "%ld misses)\n", file->name, resource->offset, chunk,
+	       wim_cache_hits, wim_cache_misses );
+
+	/* Allocate buffer if needed, shrinking the cache on failure */
+	assert ( victim != NULL );
+	if ( wim_cache_alloc ( victim, wim_chunk_size ( header ) ) != 0 ) {
+		if ( ( victim == wim_cache ) || ( victim == &wim_solid_cache ) )
+			return NULL;
+		return wim_cached_chunk ( file, header, resource, chunk,
+					  need );
+	}
+
+	/* Read chunk */
+	victim->file = NULL;
+	victim->chunk = chunk;
+	victim->len = 0;
+	if ( ( rc = wim_decode ( file, header, resource, victim,
+				 need ) ) != 0 )
+		return NULL;
+
+	/* Update cache */
+	victim->file = file;
+	victim->resource_offset = resource->offset;
+	victim->used = ++wim_cache_ticks;
+
+	return victim;
+}
+
+/**
+ * Get access stream for a compressed resource
+ *
+ * @v file		Virtual file
+ * @v resource		Resource
+ * @ret stream		Access stream
+ */
+static struct wim_stream * wim_stream ( struct vdisk_file *file,
+					struct wim_resource_header *resource ) {
+	struct wim_stream *stream;
+	struct wim_stream *victim = NULL;
+	unsigned int i;
+
+	/* Look for an existing stream, and identify the least
+	 * recently used entry in case there is none.
+	 */
+	for ( i = 0 ; i < WIM_STREAM_MAX ; i++ ) {
+		stream = &wim_streams[i];
+		if ( ( stream->file == file ) &&
+		     ( stream->resource_offset == resource->offset ) ) {
+			stream->used = ++wim_cache_ticks;
+			return stream;
+		}
+		if ( ( ! victim ) || ( stream->used < victim->used ) )
+			victim = stream;
+	}
+
+	/* Start a new stream */
+	memset ( victim, 0, sizeof ( *victim ) );
+	victim->file = file;
+	victim->resource_offset = resource->offset;
+	victim->used = ++wim_cache_ticks;
+	return victim;
+}
+
+/**
+ * Read batch of chunks from a compressed resource
+ *
+ * @v file		Virtual file
+ * @v header		WIM header
+ * @v resource		Resource
+ * @v chunk		First chunk number
+ * @v count		Number of chunks
+ * @v data		Data buffer, or NULL to read into the chunk cache
+ * @ret count		Number of chunks read, or negative error
+ *
+ * The raw data for consecutive chunks is read using a single read
+ * from the underlying file, and each chunk is then unpacked either
+ * into consecutive full-length portions of the data buffer or into
+ * the chunk cache.  Fewer chunks than requested (possibly none) may
+ * be read if the batch buffer is unavailable or too small.  The
+ * batch buffer is sized from the WIM header's chunk length, and is
+ * enlarged as needed.
+ */
+static int wim_batch ( struct vdisk_file *file, struct wim_header *header,
+		       struct wim_resource_header *resource,
+		       unsigned int chunk, unsigned int count, void *data ) {
+	static void *buf;
+	static size_t buf_len;
+	struct wim_cached_chunk *victim;
+	size_t chunk_len = wim_chunk_size ( header );
+	size_t offsets[ WIM_BATCH_MAX + 1 ];
+	size_t len;
+	void *new;
+	unsigned int i;
+	int rc;
+
+	/* Calculate batch buffer length for this chunk length */
+	len = ( WIM_BATCH_MAX * chunk_len );
+	if ( len > WIM_BATCH_MAX_LEN ) {
+		len = WIM_BATCH_MAX_LEN;
+		if ( len < chunk_len )
+			len = chunk_len;
+	}
+
+	/* Allocate (or enlarge) batch buffer, if not already done */
+	if ( buf_len < len ) {
+		new = malloc ( len );
+		if ( ! new )
+			return 0;
+		free ( buf );
+		buf = new;
+		buf_len = len;
+	}
+
+	/* Skip any leading chunks that are already cached */
+	if ( ! data ) {
+		while ( count &&
+			wim_cache_find ( file, header, resource, chunk,
+					 &victim ) ) {
+			chunk++;
+			count--;
+		}
+	}
+
+	/* Get chunk offsets, limiting batch to fit the buffer */
+	if ( count > WIM_BATCH_MAX )
+		count = WIM_BATCH_MAX;
+	if ( ( rc = wim_chunk_offset ( file, header, resource, chunk,
+				       &offsets[0] ) ) != 0 )
+		return rc;
+	for ( i = 1 ; i <= count ; i++ ) {
+		if ( ( rc = wim_chunk_offset ( file, header, resource,
+					       ( chunk + i ),
+					       &offsets[i] ) ) != 0 )
+			return rc;
+		if ( ( offsets[i] < offsets[ i - 1 ] ) ||
+		     ( ( offsets[i] - offsets[0] ) > buf_len ) )
+			break;
+	}
+	count = ( i - 1 );
+	if ( ! count )
+		return 0;
+
+	/* Read raw data for all chunks */
+	DBG2 ( "...reading %s %#llx chunks [%d,%d) %s\n", file->name,
+	       resource->offset, chunk, ( chunk + count ),
+	       ( data ? "directly" : "ahead" ) );
+	file->read ( file, buf, ( resource->offset + offsets[0] ),
+		     ( offsets[count] - offsets[0] ) );
+
+	/* Unpack each chunk */
+	for ( i = 0 ; i < count ; i++ ) {
+
+		/* Unpack directly into data buffer, if applicable */
+		if ( data ) {
+			if ( ( rc = wim_unpack ( header, resource, ( chunk + i ),
+						 ( buf + ( offsets[i] -
+							   offsets[0] ) ),
+						 ( offsets[ i + 1 ] -
+						   offsets[i] ),
+						 ( data + ( i * chunk_len ) )
+						 ) ) != 0 )
+				return rc;
+			continue;
+		}
+
+		/* Otherwise, unpack into cache (unless already cached) */
+		if ( wim_cache_find ( file, header, resource, ( chunk + i ),
+				      &victim ) )
+			continue;
+		if ( ( rc = wim_cache_alloc ( victim, chunk_len ) ) != 0 )
+			return rc;
+		victim->file = NULL;
+		if ( ( rc = wim_unpack ( header, resource, ( chunk + i ),
+					 ( buf + ( offsets[i] - offsets[0] ) ),
+					 ( offsets[ i + 1 ] - offsets[i] ),
+					 victim->buf ) ) != 0 )
+			return rc;
+		victim->file = file;
+		victim->resource_offset = resource->offset;
+		victim->chunk = ( chunk + i );
+		victim->len = wim_chunk_len ( header, resource,
+					      ( chunk + i ) );
+		victim->used = ++wim_cache_ticks;
+	}
+
+	return count;
+}
+
+/**
+ * Update read-ahead for a compressed resource
+ *
+ * @v file		Virtual file
+ * @v header		WIM header
+ * @v resource		Resource
+ * @v first		First chunk accessed
+ * @v last		Last chunk accessed
+ *
+ * Sequential access to a resource is detected, and the read-ahead
+ * window is grown (in proportion to the number of chunks consumed by
+ * each access) for as long as the access remains sequential.  The
+ * window is limited to half of the chunk cache, so that chunks read
+ * ahead are not evicted before they are used.  Solid resources, with
+ * only a single cached chunk, are never read ahead.
+ */
+static void wim_sequential ( struct vdisk_file *file,
+			     struct wim_header *header,
+			     struct wim_resource_header *resource,
+			     unsigned int first, unsigned int last ) {
+	struct wim_stream *stream;
+	unsigned int chunks;
+	unsigned int stride;
+	unsigned int max;
+	unsigned int end;
+
+	/* Do not read ahead within solid resources */
+	if ( resource->zlen__flags & WIM_RESHDR_PACKED_STREAMS )
+		return;
+
+	/* Calculate maximum read-ahead window */
+	max = cmdline_readahead;
+	if ( max > ( wim_cache_limit ( header ) / 2 ) )
+		max = ( wim_cache_limit ( header ) / 2 );
+	if ( max > WIM_BATCH_MAX )
+		max = WIM_BATCH_MAX;
+	if ( ! max )
+		return;
+
+	/* Identify stream */
+	stream = wim_stream ( file, resource );
+
+	/* Update read-ahead window */
+	if ( ( first + 1 ) < stream->next ) {
+		/* Non-sequential access: disable read-ahead */
+		stream->window = 0;
+		stream->ahead = 0;
+	} else if ( first <= stream->next ) {
+		/* Sequential access: grow window when moving into
+		 * new chunks.
+		 */
+		if ( last >= stream->next ) {
+			stride = ( last + 1 - stream->next );
+			stream->window = ( stream->window ?
+					   ( 2 * stream->window ) : 1 );
+			if ( stream->window < ( 2 * stride ) )
+				stream->window = ( 2 * stride );
+			if ( stream->window > max )
+				stream->window = max;
+		}
+	} else {
+		/* Skipped forwards: disable read-ahead */
+		stream->window = 0;
+		stream->ahead = 0;
+	}
+	stream->next = ( last + 1 );
+
+	/* Read ahead, in batches of at least half of the window */
+	if ( ! stream->window )
+		return;
+	chunks = wim_chunks ( header, resource );
+	if ( stream->ahead < stream->next )
+		stream->ahead = stream->next;
+	end = ( stream->next + stream->window );
+	if ( end > chunks )
+		end = chunks;
+	if ( ( end <= stream->ahead ) ||
+	     ( ( ( end - stream->ahead ) * 2 ) < stream->window ) )
+		return;
+	wim_batch ( file, header, resource, stream->ahead,
+		    ( end - stream->ahead ), NULL );
+	stream->ahead = end;
+}
+
+/**
+ * Read from a compressed resource
+ *
+ * @v file		Virtual file
+ * @v header		WIM header
+ * @v resource		Resource
+ * @v data		Data buffer
+ * @v offset		Starting offset
+ * @v len		Length
+ * @ret rc		Return status code
+ *
+ * The chunk length must already have been validated.
+ */
+static int wim_read_chunks ( struct vdisk_file *file,
+			     struct wim_header *header,
+			     struct wim_resource_header *resource, void *data,
+			     size_t offset, size_t len ) {
+	struct wim_cached_chunk *cached;
+	struct wim_cached_chunk *victim;
+	size_t chunk_size = wim_chunk_size ( header );
+	unsigned int first;
+	unsigned int chunk;
+	unsigned int count;
+	size_t skip_len;
+	size_t frag_len;
+	size_t chunk_len;
+	int rc;
+
+	/* Read from each chunk overlapping the target region */
+	first = chunk = ( offset / chunk_size );
+	while ( len ) {
+
+		/* Calculate chunk number */
+		chunk = ( offset / chunk_size );
+		skip_len = ( offset % chunk_size );
+
+		/* Identify any whole chunks that are not already
+		 * cached, and decode these directly into the data
+		 * buffer.
+		 */
+		for ( count = 0, frag_len = 0 ;
+		      ( ( ! skip_len ) && ( count < WIM_BATCH_MAX ) ) ;
+		      count++ ) {
+			chunk_len = wim_chunk_len ( header, resource,
+						    ( chunk + count ) );
+			if ( ( ( frag_len + chunk_len ) > len ) ||
+			     wim_cache_find ( file, header, resource,
+					      ( chunk + count ), &victim ) )
+				break;
+			frag_len += chunk_len;
+		}
+		if ( count ) {
+			rc = ( ( count > 1 ) ?
+			       wim_batch ( file, header, resource, chunk,
+					   count, data ) : 0 );
+			if ( rc < 0 )
+				return rc;
+			if ( rc == 0 ) {
+				if ( ( rc = wim_chunk ( file, header, resource,
+							chunk, data ) ) != 0 )
+					return rc;
+				rc = 1;
+			}
+			count = rc;
+			if ( frag_len > ( count * chunk_size ) )
+				frag_len = ( count * chunk_size );
+			chunk += ( count - 1 );
+			data += frag_len;
+			offset += frag_len;
+			len -= frag_len;
+			continue;
+		}
+
+		/* Otherwise, get chunk, decoding as much as is needed
+		 * if not already cached.
+		 */
+		frag_len = ( chunk_size - skip_len );
+		if ( frag_len > len )
+			frag_len = len;
+		cached = wim_cached_chunk ( file, header, resource, chunk,
+					    ( skip_len + frag_len ) );
+		if ( ! cached )
+			return -1;
+
+		/* Copy fragment from this chunk */
+		memcpy ( data, ( cached->buf + skip_len ), frag_len );
+
+		/* Move to next chunk */
+		data += frag_len;
+		offset += frag_len;
+		len -= frag_len;
+	}
+
+	/* Read ahead, if applicable */
+	wim_sequential ( file, header, resource, first, chunk );
+
+	return 0;
+}
+
+static struct wim_lookup_index * wim_lookup_index ( struct vdisk_file *file,
+						    struct wim_header *header );
+
+/**
+ * Read from a packed stream
+ *
+ * @v file		Virtual file
+ * @v header		WIM header
+ * @v resource		Resource (as recorded in the lookup table index)
+ * @v data		Data buffer
+ * @v offset		Starting offset
+ * @v len		Length
+ * @ret rc		Return status code
+ *
+ * A packed stream is read from the solid resource containing it,
+ * using the solid resource's own chunk length and compression
+ * format.
+ */
+static int wim_read_packed ( struct vdisk_file *file,
+			     struct wim_header *header,
+			     struct wim_resource_header *resource, void *data,
+			     size_t offset, size_t len ) {
+	struct wim_lookup_index *lookup;
+	struct wim_header solid_header;
+	struct wim_solid *solid = NULL;
+	uint64_t start = ( resource->offset + offset );
+	unsigned int i;
+
+	/* Find solid resource containing this stream */
+	lookup = wim_lookup_index ( file, header );
+	if ( ! lookup ) {
+		DBG ( "Cannot locate packed stream without lookup table "
+		      "index\n" );
+		return -1;
+	}
+	for ( i = 0 ; i < lookup->solids ; i++ ) {
+		solid = &lookup->solid[i];
+		if ( ( start >= solid->start ) &&
+		     ( ( start + len ) <= ( solid->start +
+					    solid->resource.len ) ) ) {
+			break;
+		}
+	}
+	if ( i == lookup->solids ) {
+		DBG ( "Packed stream %#llx+%#zx lies outside solid "
+		      "resources\n", start, len );
+		return -1;
+	}
+
+	/* Reserve solid resource chunk buffers, if not already done */
+	if ( wim_solid_reserve ( lookup->solid_chunk_len ) != 0 )
+		return -1;
+
+	/* Read from solid resource */
+	memcpy ( &solid_header, header, sizeof ( solid_header ) );
+	solid_header.flags &= ~( WIM_HDR_XPRESS | WIM_HDR_LZX | WIM_HDR_LZMS );
+	solid_header.flags |= solid->flags;
+	solid_header.chunk_len = solid->chunk_len;
+	return wim_read_chunks ( file, &solid_header, &solid->resource, data,
+				 ( start - solid->start ), len );
+}
+
+/**
+ * Read from a (possibly compressed) resource
+ *
+ * @v file		Virtual file
+ * @v header		WIM header
+ * @v resource		Resource
+ * @v data		Data buffer
+ * @v offset		Starting offset
+ * @v len		Length
+ * @ret rc		Return status code
+ */
+int wim_read ( struct vdisk_file *file, struct wim_header *header,
+	       struct wim_resource_header *resource, void *data,
+	       size_t offset, size_t len ) {
+	size_t zlen = ( resource->zlen__flags & WIM_RESHDR_ZLEN_MASK );
+	size_t chunk_size;
+
+	/* Sanity checks */
+	if ( ( offset + len ) > resource->len ) {
+		DBG ( "Resource too short (%#llx bytes)\n", resource->len );
+		return -1;
+	}
+
+	/* Do nothing if no data is requested */
+	if ( ! len )
+		return 0;
+
+	/* Read packed streams via the containing solid resource */
+	if ( resource->zlen__flags & WIM_RESHDR_PACKED_STREAMS ) {
+		return wim_read_packed ( file, header, resource, data,
+					 offset, len );
+	}
+
+	/* Sanity check */
+	if ( ( resource->offset + zlen ) > file->len ) {
+		DBG ( "Resource exceeds length of file\n" );
+		return -1;
+	}
+
+	/* If resource is uncompressed, just read the raw data */
+	if ( ! ( resource->zlen__flags & WIM_RESHDR_COMPRESSED ) ) {
+		file->read ( file, data, ( resource->offset + offset ), len );
+		return 0;
+	}
+
+	/* Check chunk length */
+	chunk_size = wim_chunk_size ( header );
+	if ( ( chunk_size < WIM_CHUNK_LEN_MIN ) ||
+	     ( chunk_size > WIM_CHUNK_LEN_MAX ) ||
+	     ( chunk_size & ( chunk_size - 1 ) ) ||
+	     ( ! wim_chunk_supported ( header->flags, chunk_size ) ) ) {
+		DBG ( "Unsupported chunk length %#zx\n", chunk_size );
+		return -1;
+	}
+
+	/* Read from compressed chunks */
+	return wim_read_chunks ( file, header, resource, data, offset, len );
+}
+
+/**
+ * Free WIM lookup table index
+ *
+ * @v lookup		Lookup table index
+ */
+static void wim_free_index ( struct wim_lookup_index *lookup ) {
+
+	free ( lookup->entries );
+	free ( lookup->slots );
+	free ( lookup->metadata );
+	free ( lookup->solid );
+	memset ( lookup, 0, sizeof ( *lookup ) );
+}
+
+/**
+ * Find WIM lookup table index hash table slot
+ *
+ * @v lookup		Lookup table index
+ * @v hash		Hash
+ * @ret slot		Slot containing hash, or empty slot if not found
+ */
+static unsigned int wim_index_slot ( struct wim_lookup_index *lookup,
+				     const struct wim_hash *hash ) {
+	unsigned int slot;
+	unsigned int num;
+	uint32_t key;
+
+	/* SHA-1 hashes are uniformly distributed, so use the leading
+	 * bytes directly as the hash table key, with linear probing.
+	 */
+	memcpy ( &key, hash, sizeof ( key ) );
+	for ( slot = ( key & lookup->mask ) ; ( num = lookup->slots[slot] ) ;
+	      slot = ( ( slot + 1 ) & lookup->mask ) ) {
+		if ( memcmp ( &lookup->entries[ num - 1 ].hash, hash,
+			      sizeof ( *hash ) ) == 0 )
+			break;
+	}
+
+	return slot;
+}
+
+/**
+ * Index WIM solid resources
+ *
+ * @v file		Virtual file
+ * @v lookup		Lookup table index
+ * @ret rc		Return status code
+ *
+ * A packed stream's offset is relative to the start of the run of
+ * consecutive solid resource entries most recently preceding it in
+ * the lookup table.  Packed stream offsets within the index are
+ * rebased to be relative to the start of the first solid resource,
+ * so that a packed stream may subsequently be located without
+ * reference to its position within the lookup table.
+ */
+static int wim_index_solids ( struct vdisk_file *file,
+			      struct wim_lookup_index *lookup ) {
+	struct wim_resource_header *resource;
+	struct wim_solid_header hdr;
+	struct wim_solid *solid;
+	uint64_t base = 0;
+	uint64_t end = 0;
+	size_t zlen;
+	int packed;
+	int run = 0;
+	unsigned int i;
+
+	/* Count solid resources */
+	for ( i = 0 ; i < lookup->count ; i++ ) {
+		resource = &lookup->entries[i].resource;
+		if ( ( resource->zlen__flags & WIM_RESHDR_PACKED_STREAMS ) &&
+		     ( resource->len == WIM_SOLID_MAGIC_LEN ) )
+			lookup->solids++;
+	}
+	if ( ! lookup->solids )
+		return 0;
+
+	/* Allocate solid resource list */
+	lookup->solid = malloc ( lookup->solids * sizeof ( lookup->solid[0] ) );
+	if ( ! lookup->solid )
+		return -1;
+	memset ( lookup->solid, 0,
+		 ( lookup->solids * sizeof ( lookup->solid[0] ) ) );
+
+	/* Record solid resources and rebase packed streams */
+	solid = lookup->solid;
+	for ( i = 0 ; i < lookup->count ; i++ ) {
+		resource = &lookup->entries[i].resource;
+
+		/* Rebase packed streams, and end any run of solid
+		 * resources.
+		 */
+		packed = ( ( resource->zlen__flags &
+			     WIM_RESHDR_PACKED_STREAMS ) != 0 );
+		if ( ! ( packed && ( resource->len == WIM_SOLID_MAGIC_LEN ) ) ){
+			if ( packed )
+				resource->offset += base;
+			run = 0;
+			continue;
+		}
+
+		/* Start a new run, if applicable */
+		if ( ! run )
+			base = end;
+		run = 1;
+		solid->start = end;
+
+		/* Read solid resource header */
+		zlen = ( resource->zlen__flags & WIM_RESHDR_ZLEN_MASK );
+		if ( ( zlen < sizeof ( hdr ) ) ||
+		     ( ( resource->offset + zlen ) > file->len ) ) {
+			memset ( &hdr, 0, sizeof ( hdr ) );
 		} else {
-			DBG ( "Can't handle unknown compression scheme %#08x "
-			      "for %#llx chunk %d at [%#llx+%#llx)\n",
-			      header->flags, resource->offset,
-			      chunk, ( resource->offset + offset ),
-			      ( resource->offset + offset + len ) );
-			return -1;
+			file->read ( file, &hdr, resource->offset,
+				     sizeof ( hdr ) );
 		}
 
-		/* Decompress data */
-		out_len = decompress ( zbuf, len, NULL );
-		if ( out_len < 0 )
-			return out_len;
-		if ( ( ( size_t ) out_len ) != expected_out_len ) {
-			DBG ( "Unexpected output length %#lx (expected %#zx)\n",
-			      out_len, expected_out_len );
-			return -1;
+		/* Record solid resource, if supported */
+		if ( ! ( ( hdr.chunk_len >= WIM_CHUNK_LEN_MIN ) &&
+			 ( hdr.chunk_len <= WIM_SOLID_CHUNK_LEN_MAX ) &&
+			 ( ! ( hdr.chunk_len & ( hdr.chunk_len - 1 ) ) ) &&
+			 ( hdr.compression <
+			   ( sizeof ( wim_solid_flags ) /
+			     sizeof ( wim_solid_flags[0] ) ) ) &&
+			 wim_chunk_supported ( wim_solid_flags[hdr.compression],
+					       hdr.chunk_len ) ) ) {
+			DBG ( "Unsupported solid resource %#llx\n",
+			      resource->offset );
+		} else {
+			solid->resource.zlen__flags =
+				( ( resource->zlen__flags &
+				    ~WIM_RESHDR_ZLEN_MASK ) |
+				  ( zlen - sizeof ( hdr ) ) );
+			solid->resource.offset = ( resource->offset +
+						   sizeof ( hdr ) );
+			solid->resource.len = hdr.len;
+			solid->chunk_len = hdr.chunk_len;
+			solid->flags = wim_solid_flags[hdr.compression];
+			if ( lookup->solid_chunk_len < hdr.chunk_len )
+				lookup->solid_chunk_len = hdr.chunk_len;
+			DBG2 ( "...indexed %s solid resource %#llx (%#llx bytes "
+			       "in %#x-byte chunks)\n", file->name,
+			       resource->offset, hdr.len, hdr.chunk_len );
 		}
-		decompress ( zbuf, len, buf->data );
+		end += hdr.len;
+		solid++;
 	}
 
+	/* Reserve buffers for the largest chunks now, unless this can
+	 * be deferred until a packed stream is first read.  Packed
+	 * streams will be unreadable if this fails.
+	 */
+	if ( lookup->solid_chunk_len && ( ! mreserve_persistent ) )
+		wim_solid_reserve ( lookup->solid_chunk_len );
+
 	return 0;
 }
 
 /**
- * Read from a (possibly compressed) resource
+ * Get WIM lookup table index
  *
  * @v file		Virtual file
  * @v header		WIM header
- * @v resource		Resource
- * @v data		Data buffer
- * @v offset		Starting offset
- * @v len		Length
- * @ret rc		Return status code
+ * @ret lookup		Lookup table index, or NULL if not available
+ *
+ * The lookup table is read in its entirety the first time that it is
+ * required, and indexed by hash and by image.  Callers must fall back
+ * to scanning the lookup table if no index is available (in which
+ * case packed streams cannot be read).
  */
-int wim_read ( struct vdisk_file *file, struct wim_header *header,
-	       struct wim_resource_header *resource, void *data,
-	       size_t offset, size_t len ) {
-	static struct vdisk_file *cached_file;
-	static size_t cached_resource_offset;
-	static unsigned int cached_chunk;
-	size_t zlen = ( resource->zlen__flags & WIM_RESHDR_ZLEN_MASK );
-	unsigned int chunk;
-	size_t skip_len;
-	size_t frag_len;
-	int rc;
-
-	/* Sanity checks */
-	if ( ( offset + len ) > resource->len ) {
-		DBG ( "Resource too short (%#llx bytes)\n", resource->len );
-		return -1;
-	}
-	if ( ( resource->offset + zlen ) > file->len ) {
-		DBG ( "Resource exceeds length of file\n" );
-		return -1;
-	}
+static struct wim_lookup_index *
+wim_lookup_index ( struct vdisk_file *file, struct wim_header *header ) {
+	struct wim_lookup_index *lookup;
+	struct wim_lookup_index *victim = NULL;
+	struct wim_indexed_entry *indexed;
+	struct wim_lookup_entry entry;
+	unsigned int count;
+	unsigned int slots;
+	unsigned int slot;
+	unsigned int i;
 
-	/* If resource is uncompressed, just read the raw data */
-	if ( ! ( resource->zlen__flags & ( WIM_RESHDR_COMPRESSED |
-					   WIM_RESHDR_PACKED_STREAMS ) ) ) {
-		file->read ( file, data, ( resource->offset + offset ), len );
-		return 0;
+	/* Look for an existing index, and identify the least recently
+	 * used entry in case there is none.
+	 */
+	for ( i = 0 ; i < WIM_INDEX_CACHE ; i++ ) {
+		lookup = &wim_indices[i];
+		if ( ( lookup->file == file ) &&
+		     ( lookup->lookup_offset == header->lookup.offset ) ) {
+			lookup->used = ++wim_cache_ticks;
+			return lookup;
+		}
+		if ( ( ! victim ) || ( lookup->used < victim->used ) )
+			victim = lookup;
 	}
 
-	/* Read from each chunk overlapping the target region */
-	while ( len ) {
-
-		/* Calculate chunk number */
-		chunk = ( offset / WIM_CHUNK_LEN );
+	/* Do not index (or evict any existing index for) an oversized
+	 * lookup table
+	 */
+	if ( header->lookup.len > WIM_INDEX_MAX_LEN )
+		return NULL;
 
-		/* Read chunk, if not already cached */
-		if ( ( file != cached_file ) ||
-		     ( resource->offset != cached_resource_offset ) ||
-		     ( chunk != cached_chunk ) ) {
+	/* Do not index a lookup table claiming to be a packed stream,
+	 * since reading it would require the index being constructed.
+	 */
+	if ( header->lookup.zlen__flags & WIM_RESHDR_PACKED_STREAMS )
+		return NULL;
+
+	/* Allocate index, with a hash table at most half full */
+	lookup = victim;
+	wim_free_index ( lookup );
+	count = ( ( ( size_t ) header->lookup.len ) / sizeof ( entry ) );
+	for ( slots = 1 ; slots < ( 2 * count ) ; slots <<= 1 ) {}
+	lookup->count = count;
+	lookup->mask = ( slots - 1 );
+	lookup->entries = malloc ( count * sizeof ( lookup->entries[0] ) );
+	lookup->slots = malloc ( slots * sizeof ( lookup->slots[0] ) );
+	lookup->metadata = malloc ( count * sizeof ( lookup->metadata[0] ) );
+	if ( ! ( lookup->entries && lookup->slots && lookup->metadata ) )
+		goto err;
+	memset ( lookup->slots, 0, ( slots * sizeof ( lookup->slots[0] ) ) );
+
+	/* Read and index entries */
+	for ( i = 0 ; i < count ; i++ ) {
 
-			/* Read chunk */
-			if ( ( rc = wim_chunk ( file, header, resource, chunk,
-						&wim_chunk_buffer ) ) != 0 )
-				return rc;
+		/* Read entry */
+		if ( wim_read ( file, header, &header->lookup, &entry,
+				( i * sizeof ( entry ) ),
+				sizeof ( entry ) ) != 0 )
+			goto err;
+		indexed = &lookup->entries[i];
+		memcpy ( &indexed->hash, &entry.hash, sizeof ( indexed->hash ) );
+		memcpy ( &indexed->resource, &entry.resource,
+			 sizeof ( indexed->resource ) );
+
+		/* Record metadata entries */
+		if ( entry.resource.zlen__flags & WIM_RESHDR_METADATA )
+			lookup->metadata[ lookup->images++ ] = i;
+
+		/* Add to hash table, unless hash is a duplicate */
+		slot = wim_index_slot ( lookup, &entry.hash );
+		if ( ! lookup->slots[slot] )
+			lookup->slots[slot] = ( i + 1 );
+	}
 
-			/* Update cache */
-			cached_file = file;
-			cached_resource_offset = resource->offset;
-			cached_chunk = chunk;
-		}
+	/* Index solid resources */
+	if ( wim_index_solids ( file, lookup ) != 0 )
+		goto err;
 
-		/* Copy fragment from this chunk */
-		skip_len = ( offset % WIM_CHUNK_LEN );
-		frag_len = ( WIM_CHUNK_LEN - skip_len );
-		if ( frag_len > len )
-			frag_len = len;
-		memcpy ( data, ( wim_chunk_buffer.data + skip_len ), frag_len );
+	/* Record index */
+	lookup->file = file;
+	lookup->lookup_offset = header->lookup.offset;
+	lookup->used = ++wim_cache_ticks;
+	DBG2 ( "...indexed %s lookup table (%d entries, %d images)\n",
+	       file->name, count, lookup->images );
 
-		/* Move to next chunk */
-		data += frag_len;
-		offset += frag_len;
-		len -= frag_len;
-	}
+	return lookup;
 
-	return 0;
+ err:
+	wim_free_index ( lookup );
+	return NULL;
 }
 
 /**
@@ -295,11 +1623,19 @@ int wim_read ( struct vdisk_file *file, struct wim_header *header,
  */
 int wim_count ( struct vdisk_file *file, struct wim_header *header,
 		unsigned int *count ) {
+	struct wim_lookup_index *lookup;
 	struct wim_lookup_entry entry;
 	size_t offset;
 	int rc;
 
-	/* Count metadata entries */
+	/* Use lookup table index, if available */
+	lookup = wim_lookup_index ( file, header );
+	if ( lookup ) {
+		*count = lookup->images;
+		return 0;
+	}
+
+	/* Otherwise, count metadata entries */
 	for ( offset = 0, *count = 0 ;
 	      ( offset + sizeof ( entry ) ) <= header->lookup.len ;
 	      offset += sizeof ( entry ) ) {
@@ -331,6 +1667,7 @@ int wim_count ( struct vdisk_file *file, struct wim_header *header,
  */
 int wim_metadata ( struct vdisk_file *file, struct wim_header *header,
 		   unsigned int index, struct wim_resource_header *meta ) {
+	struct wim_lookup_index *lookup;
 	struct wim_lookup_entry entry;
 	size_t offset;
 	unsigned int found = 0;
@@ -342,24 +1679,37 @@ int wim_metadata ( struct vdisk_file *file, struct wim_header *header,
 		return 0;
 	}
 
-	/* Look for metadata entry */
-	for ( offset = 0 ; ( offset + sizeof ( entry ) ) <= header->lookup.len ;
-	      offset += sizeof ( entry ) ) {
+	/* Use lookup table index, if available */
+	lookup = wim_lookup_index ( file, header );
+	if ( lookup ) {
+		if ( index <= lookup->images ) {
+			memcpy ( meta, &lookup->entries[ lookup->metadata[
+				 index - 1 ] ].resource, sizeof ( *meta ) );
+			return 0;
+		}
+	} else {
 
-		/* Read entry */
-		if ( ( rc = wim_read ( file, header, &header->lookup, &entry,
-				       offset, sizeof ( entry ) ) ) != 0 )
-			return rc;
+		/* Otherwise, look for metadata entry */
+		for ( offset = 0 ;
+		      ( offset + sizeof ( entry ) ) <= header->lookup.len ;
+		      offset += sizeof ( entry ) ) {
 
-		/* Look for our target entry */
-		if ( entry.resource.zlen__flags & WIM_RESHDR_METADATA ) {
-			found++;
-			DBG2 ( "...found image %d metadata at +%#zx\n",
-			       found, offset );
-			if ( found == index ) {
-				memcpy ( meta, &entry.resource,
-					 sizeof ( *meta ) );
-				return 0;
+			/* Read entry */
+			if ( ( rc = wim_read ( file, header, &header->lookup,
+					       &entry, offset,
+					       sizeof ( entry ) ) ) != 0 )
+				return rc;
+
+			/* Look for our target entry */
+			if ( entry.resource.zlen__flags & WIM_RESHDR_METADATA ){
+				found++;
+				DBG2 ( "...found image %d metadata at +%#zx\n",
+				       found, offset );
+				if ( found == index ) {
+					memcpy ( meta, &entry.resource,
+						 sizeof ( *meta ) );
+					return 0;
+				}
 			}
 		}
 	}
@@ -369,6 +1719,203 @@ int wim_metadata ( struct vdisk_file *file, struct wim_header *header,
 	return -1;
 }
 
+/**
+ * Free WIM directory tree
+ *
+ * @v tree		Directory tree
+ */
+static void wim_free_tree ( struct wim_dir_tree *tree ) {
+	struct wim_tree_block *block;
+
+	while ( ( block = tree->blocks ) ) {
+		tree->blocks = block->next;
+		free ( block );
+	}
+	memset ( tree, 0, sizeof ( *tree ) );
+}
+
+/**
+ * Allocate memory from WIM directory tree arena
+ *
+ * @v tree		Directory tree
+ * @v len		Length
+ * @ret data		Allocated memory, or NULL on failure
+ */
+static void * wim_tree_alloc ( struct wim_dir_tree *tree, size_t len ) {
+	struct wim_tree_block *block = tree->blocks;
+	size_t block_len;
+	void *data;
+
+	/* Round up to preserve alignment */
+	len = ( ( len + sizeof ( uint64_t ) - 1 ) &
+		~( sizeof ( uint64_t ) - 1 ) );
+
+	/* Allocate a new block if required */
+	if ( ( ! block ) || ( len > ( block->len - block->used ) ) ) {
+		block_len = ( ( len > WIM_TREE_BLOCK_LEN ) ?
+			      len : WIM_TREE_BLOCK_LEN );
+		block = malloc ( sizeof ( *block ) + block_len );
+		if ( ! block )
+			return NULL;
+		block->len = block_len;
+		block->used = 0;
+		block->next = tree->blocks;
+		tree->blocks = block;
+	}
+
+	/* Allocate from block */
+	data = ( block->data + block->used );
+	block->used += len;
+	return data;
+}
+
+/**
+ * Fold name to lower case
+ *
+ * @v name		Name to fold (will be modified)
+ * @ret key		Hash of folded name
+ */
+static uint32_t wim_fold ( wchar_t *name ) {
+	uint32_t key = 0;
+
+	for ( ; *name ; name++ ) {
+		*name = towlower ( *name );
+		key = ( ( key * 31 ) + *name );
+	}
+	return key;
+}
+
+/**
+ * Get WIM directory tree
+ *
+ * @v file		Virtual file
+ * @v meta		Metadata
+ * @ret tree		Directory tree
+ */
+static struct wim_dir_tree * wim_dir_tree ( struct vdisk_file *file,
+					    struct wim_resource_header *meta ) {
+	struct wim_dir_tree *tree;
+	struct wim_dir_tree *victim = NULL;
+	unsigned int i;
+
+	/* Look for an existing tree, and identify the least recently
+	 * used entry in case there is none.
+	 */
+	for ( i = 0 ; i < WIM_TREE_CACHE ; i++ ) {
+		tree = &wim_trees[i];
+		if ( ( tree->file == file ) &&
+		     ( tree->meta_offset == meta->offset ) ) {
+			tree->used = ++wim_cache_ticks;
+			return tree;
+		}
+		if ( ( ! victim ) || ( tree->used < victim->used ) )
+			victim = tree;
+	}
+	tree = victim;
+	wim_free_tree ( tree );
+
+	/* Record tree (with no directories yet parsed) */
+	tree->file = file;
+	tree->meta_offset = meta->offset;
+	tree->used = ++wim_cache_ticks;
+
+	return tree;
+}
+
+/**
+ * Get cached WIM directory
+ *
+ * @v file		Virtual file
+ * @v header		WIM header
+ * @v meta		Metadata
+ * @v tree		Directory tree
+ * @v offset		Directory offset
+ * @ret dir		Cached directory, or NULL on failure
+ *
+ * On failure, the directory tree will have been discarded.
+ */
+static struct wim_tree_dir * wim_tree_dir ( struct vdisk_file *file,
+					    struct wim_header *header,
+					    struct wim_resource_header *meta,
+					    struct wim_dir_tree *tree,
+					    size_t offset ) {
+	struct wim_directory_entry direntry;
+	struct wim_tree_entry *entry;
+	struct wim_tree_dir *dir;
+	size_t name_len;
+	size_t len;
+	unsigned int count;
+	unsigned int i;
+	wchar_t *name;
+
+	/* Use existing parsed directory, if any */
+	for ( dir = tree->dirs ; dir ; dir = dir->next ) {
+		if ( dir->offset == offset )
+			return dir;
+	}
+
+	/* Count directory entries */
+	for ( len = 0, count = 0 ; ; len += direntry.len, count++ ) {
+		if ( wim_read ( file, header, meta, &direntry, ( offset + len ),
+				sizeof ( direntry.len ) ) != 0 )
+			goto err;
+		if ( ! direntry.len )
+			break;
+	}
+
+	/* Allocate directory */
+	dir = wim_tree_alloc ( tree, sizeof ( *dir ) );
+	if ( ! dir )
+		goto err;
+	dir->entries = wim_tree_alloc ( tree, ( count *
+						sizeof ( dir->entries[0] ) ) );
+	if ( ! dir->entries )
+		goto err;
+	dir->offset = offset;
+	dir->len = len;
+	dir->count = count;
+
+	/* Parse directory entries */
+	for ( i = 0 ; i < count ; i++, offset += direntry.len ) {
+
+		/* Read fixed-length portion of directory entry */
+		if ( wim_read ( file, header, meta, &direntry, offset,
+				sizeof ( direntry ) ) != 0 )
+			goto err;
+
+		/* Read name */
+		name_len = ( direntry.name_len & ~( sizeof ( *name ) - 1 ) );
+		name = wim_tree_alloc ( tree, ( name_len + sizeof ( *name ) ) );
+		if ( ! name )
+			goto err;
+		if ( wim_read ( file, header, meta, name,
+				( offset + sizeof ( direntry ) ),
+				name_len ) != 0 )
+			goto err;
+		name[ name_len / sizeof ( *name ) ] = L'\0';
+
+		/* Record entry */
+		entry = &dir->entries[i];
+		entry->offset = offset;
+		entry->subdir = direntry.subdir;
+		memcpy ( &entry->hash, &direntry.hash, sizeof ( entry->hash ) );
+		entry->key = wim_fold ( name );
+		entry->name = name;
+	}
+
+	/* Record directory */
+	dir->next = tree->dirs;
+	tree->dirs = dir;
+	DBG2 ( "...cached %s %#zx directory (%d entries)\n",
+	       file->name, dir->offset, dir->count );
+
+	return dir;
+
+ err:
+	wim_free_tree ( tree );
+	return NULL;
+}
+
 /**
  * Get directory entry
  *
@@ -425,6 +1972,86 @@ static int wim_direntry ( struct vdisk_file *file, struct wim_header *header,
 	}
 }
 
+/**
+ * Find entry within directory
+ *
+ * @v file		Virtual file
+ * @v header		WIM header
+ * @v meta		Metadata
+ * @v dir		Directory offset
+ * @v name		Name (may be folded to lower case)
+ * @v offset		Directory entry offset to fill in
+ * @v subdir		Subdirectory offset to fill in
+ * @v hash		Hash to fill in
+ * @ret rc		Return status code
+ */
+static int wim_child ( struct vdisk_file *file, struct wim_header *header,
+		       struct wim_resource_header *meta, size_t dir,
+		       wchar_t *name, size_t *offset, size_t *subdir,
+		       struct wim_hash *hash ) {
+	struct wim_directory_entry direntry;
+	struct wim_tree_entry *entry;
+	struct wim_dir_tree *tree;
+	struct wim_tree_dir *tdir;
+	uint32_t key;
+	unsigned int i;
+	int rc;
+
+	/* Use directory tree cache, if available */
+	tree = wim_dir_tree ( file, meta );
+	tdir = wim_tree_dir ( file, header, meta, tree, dir );
+	if ( tdir ) {
+		key = wim_fold ( name );
+		for ( i = 0 ; i < tdir->count ; i++ ) {
+			entry = &tdir->entries[i];
+			if ( ( entry->key == key ) &&
+			     ( wcscasecmp ( entry->name, name ) == 0 ) ) {
+				DBG2 ( "...found entry \"%ls\"\n", name );
+				*offset = entry->offset;
+				*subdir = entry->subdir;
+				memcpy ( hash, &entry->hash, sizeof ( *hash ) );
+				return 0;
+			}
+		}
+		DBG ( "...directory entry \"%ls\" not found\n", name );
+		return -1;
+	}
+
+	/* Otherwise, search directory */
+	*offset = dir;
+	if ( ( rc = wim_direntry ( file, header, meta, name, offset,
+				   &direntry ) ) != 0 )
+		return rc;
+	*subdir = direntry.subdir;
+	memcpy ( hash, &direntry.hash, sizeof ( *hash ) );
+	return 0;
+}
+
+/**
+ * Get root directory offset
+ *
+ * @v file		Virtual file
+ * @v header		WIM header
+ * @v meta		Metadata
+ * @v offset		Root directory offset to fill in
+ * @ret rc		Return status code
+ */
+static int wim_root ( struct vdisk_file *file, struct wim_header *header,
+		      struct wim_resource_header *meta, size_t *offset ) {
+	struct wim_security_header security;
+	int rc;
+
+	/* Read security data header */
+	if ( ( rc = wim_read ( file, header, meta, &security, 0,
+			       sizeof ( security ) ) ) != 0 )
+		return rc;
+
+	/* Root directory follows security data */
+	*offset = ( ( security.len + sizeof ( uint64_t ) - 1 ) &
+		    ~( sizeof ( uint64_t ) - 1 ) );
+	return 0;
+}
+
 /**
  * Get directory entry for a path
  *
@@ -440,19 +2067,15 @@ int wim_path ( struct vdisk_file *file, struct wim_header *header,
 	       struct wim_resource_header *meta, const wchar_t *path,
 	       size_t *offset, struct wim_directory_entry *direntry ) {
 	wchar_t path_copy[ wcslen ( path ) + 1 /* WNUL */ ];
-	struct wim_security_header security;
+	struct wim_hash hash;
+	size_t subdir;
 	wchar_t *name;
 	wchar_t *next;
 	int rc;
 
-	/* Read security data header */
-	if ( ( rc = wim_read ( file, header, meta, &security, 0,
-			       sizeof ( security ) ) ) != 0 )
-		return rc;
-
 	/* Get root directory offset */
-	direntry->subdir = ( ( security.len + sizeof ( uint64_t ) - 1 ) &
-			     ~( sizeof ( uint64_t ) - 1 ) );
+	if ( ( rc = wim_root ( file, header, meta, &subdir ) ) != 0 )
+		return rc;
 
 	/* Find directory entry */
 	name = memcpy ( path_copy, path, sizeof ( path_copy ) );
@@ -460,60 +2083,240 @@ int wim_path ( struct vdisk_file *file, struct wim_header *header,
 		next = wcschr ( name, L'\\' );
 		if ( next )
 			*next = L'\0';
-		*offset = direntry->subdir;
-		if ( ( rc = wim_direntry ( file, header, meta, name, offset,
-					   direntry ) ) != 0 )
+		if ( ( rc = wim_child ( file, header, meta, subdir, name, offset,
+					&subdir, &hash ) ) != 0 )
 			return rc;
 		name = ( next + 1 );
 	} while ( next );
 
-	return 0;
+	/* Read directory entry */
+	return wim_read ( file, header, meta, direntry, *offset,
+			  sizeof ( *direntry ) );
 }
 
 /**
- * Get file resource
+ * Get file resources for a list of hashes
  *
  * @v file		Virtual file
  * @v header		WIM header
- * @v meta		Metadata
- * @v path		Path to file
- * @v resource		File resource to fill in
- * @ret rc		Return status code
+ * @v hashes		Hashes
+ * @v count		Number of hashes
+ * @v resources		File resources to fill in
+ * @v rcs		Return status codes (zero for hashes to be found)
  */
-int wim_file ( struct vdisk_file *file, struct wim_header *header,
-	       struct wim_resource_header *meta, const wchar_t *path,
-	       struct wim_resource_header *resource ) {
-	struct wim_directory_entry direntry;
+static void wim_resources ( struct vdisk_file *file, struct wim_header *header,
+			    const struct wim_hash *hashes, unsigned int count,
+			    struct wim_resource_header *resources, int *rcs ) {
+	struct wim_lookup_index *lookup;
 	struct wim_lookup_entry entry;
+	int pending[count];
+	unsigned int remaining = 0;
+	unsigned int num;
+	unsigned int i;
 	size_t offset;
-	int rc;
 
-	/* Find directory entry */
-	if ( ( rc = wim_path ( file, header, meta, path, &offset,
-			       &direntry ) ) != 0 )
-		return rc;
+	/* Identify hashes to be found */
+	for ( i = 0 ; i < count ; i++ ) {
+		pending[i] = ( rcs[i] == 0 );
+		remaining += pending[i];
+		rcs[i] = -1;
+	}
+
+	/* Use lookup table index, if available */
+	lookup = wim_lookup_index ( file, header );
+	if ( lookup ) {
+		for ( i = 0 ; i < count ; i++ ) {
+			if ( ! pending[i] )
+				continue;
+			num = lookup->slots[ wim_index_slot ( lookup,
+							      &hashes[i] ) ];
+			if ( ! num )
+				continue;
+			memcpy ( &resources[i], &lookup->entries[ num - 1 ].resource,
+				 sizeof ( resources[i] ) );
+			rcs[i] = 0;
+		}
+		return;
+	}
 
-	/* File matching file entry */
-	for ( offset = 0 ; ( offset + sizeof ( entry ) ) <= header->lookup.len ;
+	/* Otherwise, find all matching entries in a single pass */
+	for ( offset = 0 ; remaining &&
+		      ( ( offset + sizeof ( entry ) ) <= header->lookup.len ) ;
 	      offset += sizeof ( entry ) ) {
 
 		/* Read entry */
-		if ( ( rc = wim_read ( file, header, &header->lookup, &entry,
-				       offset, sizeof ( entry ) ) ) != 0 )
-			return rc;
+		if ( wim_read ( file, header, &header->lookup, &entry, offset,
+				sizeof ( entry ) ) != 0 )
+			return;
+
+		/* Look for our target entries */
+		for ( i = 0 ; i < count ; i++ ) {
+			if ( pending[i] &&
+			     ( memcmp ( &entry.hash, &hashes[i],
+					sizeof ( entry.hash ) ) == 0 ) ) {
+				memcpy ( &resources[i], &entry.resource,
+					 sizeof ( resources[i] ) );
+				pending[i] = 0;
+				remaining--;
+				rcs[i] = 0;
+			}
+		}
+	}
+}
 
-		/* Look for our target entry */
-		if ( memcmp ( &entry.hash, &direntry.hash,
-			      sizeof ( entry.hash ) ) == 0 ) {
-			DBG ( "...found file \"%ls\"\n", path );
-			memcpy ( resource, &entry.resource,
-				 sizeof ( *resource ) );
-			return 0;
+/**
+ * Find directory entries for a sorted list of paths
+ *
+ * @v file		Virtual file
+ * @v header		WIM header
+ * @v meta		Metadata
+ * @v paths		Paths to files
+ * @v order		Sorted order of paths
+ * @v count		Number of paths
+ * @v max_len		Maximum length of any path
+ * @v hashes		File hashes to fill in
+ * @v rcs		Return status codes to fill in
+ */
+static void wim_lookup_paths ( struct vdisk_file *file,
+			       struct wim_header *header,
+			       struct wim_resource_header *meta,
+			       const wchar_t **paths,
+			       const unsigned int *order, unsigned int count,
+			       size_t max_len, struct wim_hash *hashes,
+			       int *rcs ) {
+	wchar_t path_copy[ max_len + 1 /* wNUL */ ];
+	size_t dirs[ max_len + 2 ];
+	const wchar_t *path;
+	const wchar_t *prev = NULL;
+	size_t offset;
+	unsigned int depth;
+	unsigned int valid = 0;
+	unsigned int i;
+	unsigned int j;
+	unsigned int k;
+	wchar_t *name;
+	wchar_t *next;
+
+	/* Get root directory offset */
+	if ( wim_root ( file, header, meta, &dirs[0] ) != 0 )
+		return;
+
+	/* Find directory entries */
+	for ( i = 0 ; i < count ; i++ ) {
+		path = paths[ order[i] ];
+
+		/* Count directories shared with the previous path,
+		 * limited to those that were found.
+		 */
+		depth = 0;
+		for ( j = 0 ; prev && prev[j] &&
+			      ( towupper ( prev[j] ) ==
+				towupper ( path[j] ) ) ; j++ ) {
+			if ( path[j] == L'\\' )
+				depth++;
 		}
+		if ( depth > valid )
+			depth = valid;
+		prev = path;
+
+		/* Skip shared directories */
+		name = memcpy ( path_copy, path,
+				( ( wcslen ( path ) + 1 ) *
+				  sizeof ( path_copy[0] ) ) );
+		for ( k = 0 ; k < depth ; k++ )
+			name = ( wcschr ( name, L'\\' ) + 1 );
+
+		/* Find remaining path components */
+		for ( ; ; k++ ) {
+			next = wcschr ( name, L'\\' );
+			if ( next )
+				*next = L'\0';
+			if ( wim_child ( file, header, meta, dirs[k], name,
+					 &offset, &dirs[ k + 1 ],
+					 &hashes[ order[i] ] ) != 0 )
+				break;
+			if ( ! next ) {
+				rcs[ order[i] ] = 0;
+				break;
+			}
+			name = ( next + 1 );
+		}
+		valid = k;
 	}
+}
 
-	DBG ( "Cannot find file %ls\n", path );
-	return -1;
+/**
+ * Get file resources for a list of paths
+ *
+ * @v file		Virtual file
+ * @v header		WIM header
+ * @v meta		Metadata
+ * @v paths		Paths to files
+ * @v count		Number of paths
+ * @v resources		File resources to fill in
+ * @v rcs		Return status codes to fill in
+ *
+ * The paths are sorted so that paths sharing a directory are
+ * adjacent, and are resolved in a single walk of the directory tree
+ * that never revisits a shared directory.  The file resources are
+ * then located in a single pass over the lookup table.
+ */
+void wim_lookup_files ( struct vdisk_file *file, struct wim_header *header,
+			struct wim_resource_header *meta,
+			const wchar_t **paths, unsigned int count,
+			struct wim_resource_header *resources, int *rcs ) {
+	struct wim_hash hashes[count];
+	unsigned int order[count];
+	size_t max_len = 0;
+	size_t len;
+	unsigned int i;
+	unsigned int j;
+
+	/* Sort paths */
+	for ( i = 0 ; i < count ; i++ ) {
+		rcs[i] = -1;
+		len = wcslen ( paths[i] );
+		if ( len > max_len )
+			max_len = len;
+		for ( j = i ; j && ( wcscasecmp ( paths[ order[ j - 1 ] ],
+						  paths[i] ) > 0 ) ; j-- ) {
+			order[j] = order[ j - 1 ];
+		}
+		order[j] = i;
+	}
+
+	/* Find directory entries */
+	wim_lookup_paths ( file, header, meta, paths, order, count, max_len,
+			   hashes, rcs );
+
+	/* Find file resources */
+	wim_resources ( file, header, hashes, count, resources, rcs );
+	for ( i = 0 ; i < count ; i++ ) {
+		if ( rcs[i] == 0 ) {
+			DBG ( "...found file \"%ls\"\n", paths[i] );
+		} else {
+			DBG ( "Cannot find file %ls\n", paths[i] );
+		}
+	}
+}
+
+/**
+ * Get file resource
+ *
+ * @v file		Virtual file
+ * @v header		WIM header
+ * @v meta		Metadata
+ * @v path		Path to file
+ * @v resource		File resource to fill in
+ * @ret rc		Return status code
+ */
+int wim_file ( struct vdisk_file *file, struct wim_header *header,
+	       struct wim_resource_header *meta, const wchar_t *path,
+	       struct wim_resource_header *resource ) {
+	int rc;
+
+	wim_lookup_files ( file, header, meta, &path, 1, resource, &rc );
+	return rc;
 }
 
 /**
@@ -530,9 +2333,19 @@ int wim_dir_len ( struct vdisk_file *file, struct wim_header *header,
 		  struct wim_resource_header *meta, size_t offset,
 		  size_t *len ) {
 	struct wim_directory_entry direntry;
+	struct wim_dir_tree *tree;
+	struct wim_tree_dir *dir;
 	int rc;
 
-	/* Search directory */
+	/* Use directory tree cache, if available */
+	tree = wim_dir_tree ( file, meta );
+	dir = wim_tree_dir ( file, header, meta, tree, offset );
+	if ( dir ) {
+		*len = dir->len;
+		return 0;
+	}
+
+	/* Otherwise, search directory */
 	for ( *len = 0 ; ; *len += direntry.len ) {
 
 		/* Read length field */
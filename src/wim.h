@@ -59,6 +59,37 @@ enum wim_resource_header_flags {
 	WIM_RESHDR_PACKED_STREAMS = ( 0x10ULL << 56 ),
 };
 
+/** Uncompressed length recorded in a solid resource's lookup table entry
+ *
+ * Lookup table entries with the packed streams flag describe either a
+ * solid resource (with this magic uncompressed length) or a stream
+ * packed within the preceding run of solid resources (with an offset
+ * relative to the start of the run).
+ */
+#define WIM_SOLID_MAGIC_LEN 0x100000000ULL
+
+/** A WIM solid resource header */
+struct wim_solid_header {
+	/** Uncompressed length */
+	uint64_t len;
+	/** Chunk length */
+	uint32_t chunk_len;
+	/** Compression format */
+	uint32_t compression;
+} __attribute__ (( packed ));
+
+/** WIM solid resource compression formats */
+enum wim_solid_compression {
+	/** Uncompressed */
+	WIM_SOLID_NONE = 0,
+	/** Xpress compression */
+	WIM_SOLID_XPRESS = 1,
+	/** LZX compression */
+	WIM_SOLID_LZX = 2,
+	/** LZMS compression */
+	WIM_SOLID_LZMS = 3,
+};
+
 /** A WIM header */
 struct wim_header {
 	/** Signature */
@@ -99,6 +130,8 @@ enum wim_header_flags {
 	WIM_HDR_XPRESS = 0x00020000,
 	/** WIM uses LZX compression */
 	WIM_HDR_LZX = 0x00040000,
+	/** WIM uses LZMS compression */
+	WIM_HDR_LZMS = 0x00080000,
 };
 
 /** A WIM file hash */
@@ -119,15 +152,163 @@ struct wim_lookup_entry {
 	struct wim_hash hash;
 } __attribute__ (( packed ));
 
-/** WIM chunk length */
+/** Default WIM chunk length */
 #define WIM_CHUNK_LEN 32768
 
+/** Minimum WIM chunk length */
+#define WIM_CHUNK_LEN_MIN 4096
+
+/** Maximum WIM chunk length */
+#define WIM_CHUNK_LEN_MAX ( 2 * 1024 * 1024 )
+
+/** Maximum WIM solid resource chunk length
+ *
+ * Solid resource chunks are typically much larger than the chunks of
+ * other resources, and may well be too large to decode within the
+ * available heap.  Buffers for these chunks (of twice the largest
+ * indexed solid resource chunk length) are therefore reserved
+ * directly from the platform, and this limit must remain within what
+ * the loader can reasonably afford to reserve.
+ */
+#define WIM_SOLID_CHUNK_LEN_MAX ( 64 * 1024 * 1024 )
+
+/** Number of cached WIM lookup table indices */
+#define WIM_INDEX_CACHE 4
+
+/** Maximum length of an indexed WIM lookup table */
+#define WIM_INDEX_MAX_LEN ( 2 * 1024 * 1024 )
+
+/** An indexed WIM lookup table entry */
+struct wim_indexed_entry {
+	/** Hash */
+	struct wim_hash hash;
+	/** Resource header */
+	struct wim_resource_header resource;
+} __attribute__ (( packed ));
+
+/** An indexed WIM solid resource */
+struct wim_solid {
+	/** Offset within all packed streams in the lookup table */
+	uint64_t start;
+	/** Chunked data (following the solid resource header) */
+	struct wim_resource_header resource;
+	/** Chunk length */
+	uint32_t chunk_len;
+	/** Equivalent WIM header compression flag */
+	uint32_t flags;
+};
+
+/** A WIM lookup table index */
+struct wim_lookup_index {
+	/** Virtual file, or NULL if this entry is unused */
+	struct vdisk_file *file;
+	/** Lookup table offset */
+	size_t lookup_offset;
+	/** Time of last use */
+	unsigned long used;
+	/** Number of entries */
+	unsigned int count;
+	/** Entries (in lookup table order) */
+	struct wim_indexed_entry *entries;
+	/** Hash table mask (i.e. number of hash table slots minus one) */
+	unsigned int mask;
+	/** Hash table slots (entry number plus one, or zero if empty) */
+	unsigned int *slots;
+	/** Number of images */
+	unsigned int images;
+	/** Entry numbers of image metadata resources */
+	unsigned int *metadata;
+	/** Number of solid resources */
+	unsigned int solids;
+	/** Solid resources (in lookup table order) */
+	struct wim_solid *solid;
+	/** Largest solid resource chunk length */
+	uint32_t solid_chunk_len;
+};
+
+/** Number of cached WIM chunk offset tables */
+#define WIM_TABLE_CACHE 8
+
+/** Maximum length of a cached WIM chunk offset table */
+#define WIM_TABLE_MAX_LEN ( 512 * 1024 )
+
+/** A cached WIM chunk offset table */
+struct wim_chunk_table {
+	/** Virtual file, or NULL if this entry is unused */
+	struct vdisk_file *file;
+	/** Resource offset */
+	size_t resource_offset;
+	/** Time of last use */
+	unsigned long used;
+	/** Raw chunk offsets (excluding chunk 0) */
+	void *offsets;
+};
+
 /** A WIM chunk buffer */
 struct wim_chunk_buffer {
 	/** Data */
 	uint8_t data[WIM_CHUNK_LEN];
 };
 
+/** Maximum number of cached WIM chunks */
+#define WIM_CACHE_MAX 64
+
+/** Maximum total length of cached WIM chunks */
+#define WIM_CACHE_MAX_LEN ( WIM_CACHE_MAX * WIM_CHUNK_LEN )
+
+/** A cached WIM chunk */
+struct wim_cached_chunk {
+	/** Virtual file, or NULL if this entry is unused */
+	struct vdisk_file *file;
+	/** Resource offset */
+	size_t resource_offset;
+	/** Chunk number */
+	unsigned int chunk;
+	/** Length of decoded data within chunk buffer */
+	size_t len;
+	/** Time of last use */
+	unsigned long used;
+	/** Chunk buffer, or NULL if not yet allocated */
+	uint8_t *buf;
+	/** Length of chunk buffer */
+	size_t buf_len;
+};
+
+/** Maximum number of WIM chunks read in a single batch */
+#define WIM_BATCH_MAX 8
+
+/** Maximum length of WIM batch buffer
+ *
+ * The batch buffer is sized to hold WIM_BATCH_MAX chunks of the WIM
+ * header's chunk length, subject to this limit (but always large
+ * enough to hold at least a single chunk).  Batches of larger chunks
+ * are therefore shorter.
+ */
+#define WIM_BATCH_MAX_LEN ( 1024 * 1024 )
+
+/** Maximum number of tracked WIM resource streams */
+#define WIM_STREAM_MAX 4
+
+/** A WIM resource access stream
+ *
+ * Used to detect sequential access to a compressed resource, so that
+ * subsequent chunks may be read ahead into the chunk cache.
+ */
+struct wim_stream {
+	/** Virtual file, or NULL if this entry is unused */
+	struct vdisk_file *file;
+	/** Resource offset */
+	size_t resource_offset;
+	/** Time of last use */
+	unsigned long used;
+	/** Next chunk expected to be accessed */
+	unsigned int next;
+	/** First chunk not yet read ahead */
+	unsigned int ahead;
+	/** Read-ahead window (in chunks) */
+	unsigned int window;
+};
+
 /** Security data */
 struct wim_security_header {
 	/** Length */
@@ -166,6 +347,71 @@ struct wim_directory_entry {
 	uint16_t name_len;
 } __attribute__ (( packed ));
 
+/** Number of cached WIM directory trees */
+#define WIM_TREE_CACHE 2
+
+/** Length of a WIM directory tree arena block */
+#define WIM_TREE_BLOCK_LEN 16384
+
+/** A WIM directory tree arena block */
+struct wim_tree_block {
+	/** Next block */
+	struct wim_tree_block *next;
+	/** Length of data */
+	size_t len;
+	/** Length of data used */
+	size_t used;
+	/** Data */
+	uint8_t data[0];
+};
+
+/** A cached WIM directory entry */
+struct wim_tree_entry {
+	/** Directory entry offset */
+	size_t offset;
+	/** Subdirectory offset */
+	size_t subdir;
+	/** Hash */
+	struct wim_hash hash;
+	/** Hash of folded name */
+	uint32_t key;
+	/** Name (folded to lower case) */
+	wchar_t *name;
+};
+
+/** A cached WIM directory */
+struct wim_tree_dir {
+	/** Next cached directory */
+	struct wim_tree_dir *next;
+	/** Directory offset */
+	size_t offset;
+	/** Directory length (excluding terminator) */
+	size_t len;
+	/** Number of entries */
+	unsigned int count;
+	/** Entries (in directory order) */
+	struct wim_tree_entry *entries;
+};
+
+/** A cached WIM directory tree
+ *
+ * Directories are parsed only when first visited.  All parsed data is
+ * allocated from a private arena, which is freed in its entirety when
+ * the tree is discarded.
+ */
+struct wim_dir_tree {
+	/** Virtual file, or NULL if this entry is unused */
+	struct vdisk_file *file;
+	/** Metadata resource offset */
+	size_t meta_offset;
+	/** Time of last use */
+	unsigned long used;
+	/** Parsed directories */
+	struct wim_tree_dir *dirs;
+	/** Arena blocks */
+	struct wim_tree_block *blocks;
+};
+
 /** Normal file */
 #define WIM_ATTR_NORMAL 0x00000080UL
 
@@ -189,6 +435,12 @@ extern int wim_path ( struct vdisk_file *file, struct wim_header *header,
 extern int wim_file ( struct vdisk_file *file, struct wim_header *header,
 		      struct wim_resource_header *meta, const wchar_t *path,
 		      struct wim_resource_header *resource );
+extern void wim_lookup_files ( struct vdisk_file *file,
+			       struct wim_header *header,
+			       struct wim_resource_header *meta,
+			       const wchar_t **paths, unsigned int count,
+			       struct wim_resource_header *resources,
+			       int *rcs );
 extern int wim_dir_len ( struct vdisk_file *file, struct wim_header *header,
 			 struct wim_resource_header *meta, size_t offset,
 			 size_t *len );
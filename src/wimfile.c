@@ -71,63 +71,94 @@ static void wim_read_file ( struct vdisk_file *file, void *data,
 }
 
 /**
- * Add WIM virtual file
+ * Add WIM virtual files for a list of paths
  *
  * @v file		Underlying virtual file
  * @v index		Image index, or 0 to use boot image
- * @v path		Path to file within WIM
- * @ret file		Virtual file, or NULL if not found
+ * @v paths		List of paths to files within WIM
+ * @v count		Number of paths
+ * @v files		Virtual files to fill in, or NULL
  */
-struct vdisk_file * wim_add_file ( struct vdisk_file *file, unsigned int index,
-				   const wchar_t *path ) {
+static void wim_add_paths ( struct vdisk_file *file, unsigned int index,
+			    const wchar_t **paths, unsigned int count,
+			    struct vdisk_file **files ) {
 	static unsigned int wim_file_idx = 0;
+	char names[count][ VDISK_NAME_LEN + 1 /* NUL */ ];
+	const wchar_t *wanted[count];
+	struct wim_resource_header resources[count];
+	unsigned int map[count];
+	int rcs[count];
 	struct wim_resource_header meta;
+	struct wim_header header;
 	struct wim_file *wfile;
+	struct vdisk_file *vfile;
 	const wchar_t *wname;
 	const wchar_t *tmp;
-	char name[ VDISK_NAME_LEN + 1 /* NUL */ ];
+	unsigned int found;
 	unsigned int i;
+	unsigned int j;
 	int rc;
 
-	/* Sanity check */
-	if ( wim_file_idx >= WIM_MAX_FILES )
-		die ( "Too many WIM files\n" );
-	wfile = &wim_files[wim_file_idx];
-
-	/* Construct file name */
-	wname = path;
-	for ( tmp = wname ; *tmp ; tmp++ ) {
-		if ( *tmp == L'\\' )
-			wname = ( tmp + 1 );
-	}
-
-	/* Construct ASCII file name */
-	snprintf ( name, sizeof ( name ), "%ls", wname );
-
-	/* Skip files already added explicitly */
-	for ( i = 0 ; i < VDISK_MAX_FILES ; i++ ) {
-		if ( strcasecmp ( name, vdisk_files[i].name ) == 0 )
-			return NULL;
+	/* Construct ASCII file names, and skip files already added
+	 * explicitly.
+	 */
+	for ( i = 0, found = 0 ; i < count ; i++ ) {
+		wname = paths[i];
+		for ( tmp = wname ; *tmp ; tmp++ ) {
+			if ( *tmp == L'\\' )
+				wname = ( tmp + 1 );
+		}
+		snprintf ( names[i], sizeof ( names[i] ), "%ls", wname );
+		for ( j = 0 ; j < VDISK_MAX_FILES ; j++ ) {
+			if ( strcasecmp ( names[i], vdisk_files[j].name ) == 0 )
+				break;
+		}
+		if ( j == VDISK_MAX_FILES ) {
+			wanted[found] = paths[i];
+			map[found++] = i;
+		}
 	}
+	if ( ! found )
+		return;
 
 	/* Get WIM header */
-	if ( ( rc = wim_header ( file, &wfile->header ) ) != 0 )
-		return NULL;
+	if ( ( rc = wim_header ( file, &header ) ) != 0 )
+		return;
 
 	/* Get image metadata */
-	if ( ( rc = wim_metadata ( file, &wfile->header, index, &meta ) ) != 0 )
-		return NULL;
-
-	/* Get file resource */
-	if ( ( rc = wim_file ( file, &wfile->header, &meta, path,
-			       &wfile->resource ) ) != 0 )
-		return NULL;
-
-	/* Add virtual file */
-	wim_file_idx++;
-	wfile->file = file;
-	return vdisk_add_file ( name, wfile, wfile->resource.len,
-				wim_read_file );
+	if ( ( rc = wim_metadata ( file, &header, index, &meta ) ) != 0 )
+		return;
+
+	/* Get file resources */
+	wim_lookup_files ( file, &header, &meta, wanted, found, resources,
+			   rcs );
+
+	/* Add virtual files, skipping any file with the same name as
+	 * a file already found earlier in the list.
+	 */
+	for ( i = 0 ; i < found ; i++ ) {
+		if ( rcs[i] != 0 )
+			continue;
+		for ( j = 0 ; j < i ; j++ ) {
+			if ( ( rcs[j] == 0 ) &&
+			     ( strcasecmp ( names[ map[i] ],
+					    names[ map[j] ] ) == 0 ) )
+				break;
+		}
+		if ( j < i )
+			continue;
+		if ( wim_file_idx >= WIM_MAX_FILES )
+			die ( "Too many WIM files\n" );
+		wfile = &wim_files[ wim_file_idx++ ];
+		wfile->file = file;
+		memcpy ( &wfile->header, &header, sizeof ( wfile->header ) );
+		memcpy ( &wfile->resource, &resources[i],
+			 sizeof ( wfile->resource ) );
+		vfile = vdisk_add_file ( names[ map[i] ], wfile,
+					 wfile->resource.len, wim_read_file );
+		if ( files )
+			files[ map[i] ] = vfile;
+	}
 }
 
 /**
@@ -136,12 +167,20 @@ struct vdisk_file * wim_add_file ( struct vdisk_file *file, unsigned int index,
  * @v file		Underlying virtual file
  * @v index		Image index, or 0 to use boot image
  * @v paths		List of paths to files within WIM
+ * @v files		Virtual files to fill in (or NULL if not found), or NULL
+ *
+ * All existent files within the list are added, using a single
+ * traversal of the image metadata and lookup table.
  */
 void wim_add_files ( struct vdisk_file *file, unsigned int index,
-		     const wchar_t **paths ) {
-	const wchar_t **path;
+		     const wchar_t **paths, struct vdisk_file **files ) {
+	unsigned int count;
+
+	/* Count paths */
+	for ( count = 0 ; paths[count] ; count++ ) {}
+	if ( files )
+		memset ( files, 0, ( count * sizeof ( files[0] ) ) );
 
-	/* Add any existent files within the list */
-	for ( path = paths ; *path ; path++ )
-		wim_add_file ( file, index, *path );
+	/* Add files */
+	wim_add_paths ( file, index, paths, count, files );
 }
@@ -31,10 +31,7 @@
 
 struct vdisk_file;
 
-extern struct vdisk_file * wim_add_file ( struct vdisk_file *file,
-					  unsigned int index,
-					  const wchar_t *path );
 extern void wim_add_files ( struct vdisk_file *file, unsigned int index,
-			    const wchar_t **paths );
+			    const wchar_t **paths, struct vdisk_file **files );
 
 #endif /* _WIMFILE_H */
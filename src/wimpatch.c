@@ -25,9 +25,11 @@
  */
 
 #include <stddef.h>
+#include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <strings.h>
+#include <ctype.h>
 #include <assert.h>
 #include "wimboot.h"
 #include "cmdline.h"
@@ -39,6 +41,12 @@
 /** Directory into which files are injected */
 #define WIM_INJECT_DIR "\\Windows\\System32"
 
+/** Block size used when calculating hashes of injected files */
+#define WIM_HASH_BLOCK_LEN 4096
+
+/** Name of manifest listing hashes of injected files */
+#define WIM_MANIFEST "wimboot.sha1"
+
 struct wim_patch;
 
 /** A region of a patched WIM file */
@@ -104,6 +112,18 @@ union wim_patch_regions {
 	struct wim_patch_region region[0];
 };
 
+/** Number of regions of a patched WIM file */
+#define WIM_PATCH_REGIONS ( sizeof ( union wim_patch_regions ) /	\
+			    sizeof ( struct wim_patch_region ) )
+
+/** An entry in the index of patched WIM regions */
+struct wim_patch_index {
+	/** Patch region */
+	struct wim_patch_region *region;
+	/** Maximum ending offset of this and all preceding regions */
+	size_t end;
+};
+
 /** An injected directory entry */
 struct wim_patch_dir_entry {
 	/** Directory entry */
@@ -126,6 +146,16 @@ struct wim_patch_dir {
 	size_t subdir;
 };
 
+/** An injected file */
+struct wim_patch_file {
+	/** Hash of file contents */
+	struct wim_hash hash;
+	/** Hash is known (i.e. calculated or listed in the manifest) */
+	int hashed;
+	/** Hash is listed in the manifest and must be verified */
+	int verify;
+};
+
 /** A patched WIM file */
 struct wim_patch {
 	/** Virtual file */
@@ -142,6 +172,14 @@ struct wim_patch {
 	struct wim_patch_dir dir;
 	/** Patched regions */
 	union wim_patch_regions regions;
+	/** Used patched regions, in order of starting offset */
+	struct wim_patch_index index[WIM_PATCH_REGIONS];
+	/** Number of used patched regions */
+	unsigned int count;
+	/** Start of unpatched remainder of original image body */
+	size_t untouched;
+	/** Injected files */
+	struct wim_patch_file injected[VDISK_MAX_FILES];
 };
 
 /**
@@ -161,8 +199,8 @@ static size_t wim_align ( size_t len ) {
  * @v hash		Hash to fill in
  */
 static void wim_hash ( struct vdisk_file *vfile, struct wim_hash *hash ) {
+	static uint8_t buf[WIM_HASH_BLOCK_LEN];
 	uint8_t ctx[SHA1_CTX_SIZE];
-	uint8_t buf[512];
 	size_t offset;
 	size_t len;
 
@@ -182,6 +220,189 @@ static void wim_hash ( struct vdisk_file *vfile, struct wim_hash *hash ) {
 	sha1_final ( ctx, hash->sha1 );
 }
 
+/**
+ * Get hash of injected file
+ *
+ * @v patch		WIM patch
+ * @v rfile		Injected file content region
+ * @ret hash		Hash of file contents
+ *
+ * The hash is taken from the manifest if listed there, and is
+ * otherwise calculated only when first required (i.e. when the
+ * corresponding lookup table or directory entry is first read).  It
+ * is then retained for subsequent reads.
+ */
+static struct wim_hash * wim_patch_hash ( struct wim_patch *patch,
+					  struct wim_patch_region *rfile ) {
+	struct wim_patch_file *pfile =
+		&patch->injected[ rfile - patch->regions.file ];
+	struct vdisk_file *vfile = rfile->opaque;
+	struct wim_hash hash;
+
+	/* Calculate hash, if not already known */
+	if ( ! pfile->hashed ) {
+		wim_hash ( vfile, &pfile->hash );
+		pfile->hashed = 1;
+		DBG2 ( "...hashed WIM injected file %s\n", vfile->name );
+	}
+
+	/* Verify hash listed in manifest, if applicable */
+	if ( pfile->verify ) {
+		wim_hash ( vfile, &hash );
+		if ( memcmp ( &hash, &pfile->hash, sizeof ( hash ) ) != 0 ) {
+			die ( "Incorrect %s hash for %s\n",
+			      WIM_MANIFEST, vfile->name );
+		}
+		pfile->verify = 0;
+		DBG2 ( "...verified WIM injected file %s\n", vfile->name );
+	}
+
+	return &pfile->hash;
+}
+
+/**
+ * Parse hexadecimal hash
+ *
+ * @v text		Text
+ * @v hash		Hash to fill in
+ * @ret rc		Return status code
+ */
+static int wim_parse_hash ( const char *text, struct wim_hash *hash ) {
+	unsigned int digit;
+	unsigned int i;
+	int chr;
+
+	for ( i = 0 ; i < ( 2 * sizeof ( hash->sha1 ) ) ; i++ ) {
+		chr = tolower ( text[i] );
+		if ( ( chr >= '0' ) && ( chr <= '9' ) ) {
+			digit = ( chr - '0' );
+		} else if ( ( chr >= 'a' ) && ( chr <= 'f' ) ) {
+			digit = ( chr - 'a' + 10 );
+		} else {
+			return -1;
+		}
+		hash->sha1[ i / 2 ] = ( ( hash->sha1[ i / 2 ] << 4 ) | digit );
+	}
+
+	return 0;
+}
+
+/**
+ * Apply manifest line
+ *
+ * @v patch		WIM patch
+ * @v line		Line (will be modified)
+ * @ret listed		Line lists an injected file
+ *
+ * Lines are of the form "<hash> <name>" (or "<hash> *<name>"), as
+ * generated by sha1sum.  Any directory portion of the name is
+ * ignored.
+ */
+static int wim_manifest_line ( struct wim_patch *patch, char *line ) {
+	struct wim_patch_region *rfile;
+	struct wim_patch_file *pfile;
+	struct vdisk_file *vfile;
+	struct wim_hash hash;
+	char *name;
+	char *tmp;
+	unsigned int i;
+
+	/* Parse hash */
+	if ( wim_parse_hash ( line, &hash ) != 0 )
+		return 0;
+	name = ( line + ( 2 * sizeof ( hash.sha1 ) ) );
+	if ( ! isspace ( *name ) )
+		return 0;
+
+	/* Parse name */
+	while ( isspace ( *name ) )
+		name++;
+	if ( *name == '*' )
+		name++;
+	for ( tmp = name ; *tmp ; tmp++ ) {
+		if ( ( *tmp == '/' ) || ( *tmp == '\\' ) )
+			name = ( tmp + 1 );
+	}
+	while ( ( tmp > name ) && isspace ( tmp[-1] ) )
+		*(--tmp) = '\0';
+
+	/* Record hash for matching injected file */
+	for ( i = 0 ; i < VDISK_MAX_FILES ; i++ ) {
+		rfile = &patch->regions.file[i];
+		pfile = &patch->injected[i];
+		vfile = rfile->opaque;
+		if ( ! rfile->patch )
+			continue;
+		if ( strcasecmp ( name, vfile->name ) != 0 )
+			continue;
+		memcpy ( &pfile->hash, &hash, sizeof ( pfile->hash ) );
+		pfile->hashed = 1;
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Apply manifest of injected file hashes, if present
+ *
+ * @v patch		WIM patch
+ */
+static void wim_manifest ( struct wim_patch *patch ) {
+	struct vdisk_file *manifest;
+	struct wim_patch_file *pfile;
+	unsigned int listed = 0;
+	unsigned int verified = 0;
+	unsigned int i;
+	char *text;
+	char *line;
+	char *tmp;
+
+	/* Locate manifest, if present */
+	for ( i = 0 ; i < VDISK_MAX_FILES ; i++ ) {
+		manifest = &vdisk_files[i];
+		if ( manifest->read &&
+		     ( strcasecmp ( manifest->name, WIM_MANIFEST ) == 0 ) )
+			break;
+	}
+	if ( i == VDISK_MAX_FILES )
+		return;
+
+	/* Read manifest */
+	text = malloc ( manifest->len + 1 /* NUL */ );
+	if ( ! text ) {
+		DBG ( "...could not read WIM manifest %s\n", manifest->name );
+		return;
+	}
+	manifest->read ( manifest, text, 0, manifest->len );
+	text[manifest->len] = '\0';
+
+	/* Apply each line in turn */
+	for ( line = text ; *line ; line = tmp ) {
+		for ( tmp = line ; *tmp ; tmp++ ) {
+			if ( *tmp == '\n' ) {
+				*(tmp++) = '\0';
+				break;
+			}
+		}
+		listed += wim_manifest_line ( patch, line );
+	}
+	free ( text );
+
+	/* Select listed hashes to be verified */
+	if ( cmdline_verify ) {
+		for ( i = 0 ; i < VDISK_MAX_FILES ; i++ ) {
+			pfile = &patch->injected[i];
+			if ( ! pfile->hashed )
+				continue;
+			if ( ( verified++ % cmdline_verify ) == 0 )
+				pfile->verify = 1;
+		}
+	}
+	DBG ( "...patching WIM using %s for %u injected files\n",
+	      manifest->name, listed );
+}
+
 /**
  * Determine whether or not to inject file
  *
@@ -214,6 +435,10 @@ static int wim_inject_file ( struct vdisk_file *vfile ) {
 	if ( strcasecmp ( vfile->name, "boot.stl" ) == 0 )
 		return 0;
 
+	/* Ignore injected file hash manifest */
+	if ( strcasecmp ( vfile->name, WIM_MANIFEST ) == 0 )
+		return 0;
+
 	/* Locate file extension */
 	name_len = strlen ( vfile->name );
 	ext = ( ( name_len > 4 ) ? ( vfile->name + name_len - 4 ) : "" );
@@ -360,7 +585,7 @@ static int wim_patch_lookup_boot ( struct wim_patch *patch,
  * @v len		Length
  * @ret rc		Return status code
  */
-static int wim_patch_lookup_file ( struct wim_patch *patch __unused,
+static int wim_patch_lookup_file ( struct wim_patch *patch,
 				   struct wim_patch_region *region,
 				   void *data, size_t offset, size_t len ) {
 	struct wim_patch_region *rfile = region->opaque;
@@ -377,7 +602,8 @@ static int wim_patch_lookup_file ( struct wim_patch *patch __unused,
 	entry.resource.len = vfile->len;
 	entry.resource.zlen__flags = entry.resource.len;
 	entry.refcnt = 1;
-	wim_hash ( vfile, &entry.hash );
+	memcpy ( &entry.hash, wim_patch_hash ( patch, rfile ),
+		 sizeof ( entry.hash ) );
 
 	/* Copy lookup table entry */
 	memcpy ( data, ( ( ( void * ) &entry ) + offset ), len );
@@ -471,7 +697,7 @@ static int wim_patch_dir_copy ( struct wim_patch *patch,
  * @v len		Length
  * @ret rc		Return status code
  */
-static int wim_patch_dir_file ( struct wim_patch *patch __unused,
+static int wim_patch_dir_file ( struct wim_patch *patch,
 				struct wim_patch_region *region,
 				void *data, size_t offset, size_t len ) {
 	struct wim_patch_region *rfile = region->opaque;
@@ -492,7 +718,8 @@ static int wim_patch_dir_file ( struct wim_patch *patch __unused,
 	entry.dir.created = WIM_MAGIC_TIME;
 	entry.dir.accessed = WIM_MAGIC_TIME;
 	entry.dir.written = WIM_MAGIC_TIME;
-	wim_hash ( vfile, &entry.dir.hash );
+	memcpy ( &entry.dir.hash, wim_patch_hash ( patch, rfile ),
+		 sizeof ( entry.dir.hash ) );
 	entry.dir.name_len = ( name_len * sizeof ( entry.name[0] ) );
 	for ( i = 0 ; i < name_len ; i++ )
 		entry.name[i] = vfile->name[i];
@@ -717,6 +944,9 @@ static int wim_construct_patch ( struct vdisk_file *file,
 	if ( injected == 0 )
 		return 0;
 
+	/* Apply manifest of injected file hashes, if present */
+	wim_manifest ( patch );
+
 	/* Calculate boot index for injected image */
 	if ( ( rc = wim_count ( file, &patch->header, &boot_index ) ) != 0 )
 		return rc;
@@ -772,6 +1002,56 @@ static int wim_construct_patch ( struct vdisk_file *file,
 	return 0;
 }
 
+/**
+ * Construct WIM patch region index
+ *
+ * @v patch		WIM patch
+ *
+ * Regions sharing a starting offset retain their construction order,
+ * and a region nested within another (such as the subdirectory
+ * offset within the copy of the original boot image metadata) always
+ * starts after the region containing it.  Patching regions in index
+ * order therefore preserves the order in which they were defined.
+ */
+static void wim_index_patch ( struct wim_patch *patch ) {
+	struct wim_patch_index *index = patch->index;
+	struct wim_patch_region *region;
+	size_t body_len = patch->file->len;
+	size_t end = 0;
+	unsigned int count = 0;
+	unsigned int i;
+	unsigned int j;
+
+	/* Sort used regions by starting offset */
+	for ( i = 0 ; i < WIM_PATCH_REGIONS ; i++ ) {
+		region = &patch->regions.region[i];
+		if ( ! region->patch )
+			continue;
+		for ( j = count++ ; j ; j-- ) {
+			if ( index[ j - 1 ].region->offset <= region->offset )
+				break;
+			index[j].region = index[ j - 1 ].region;
+		}
+		index[j].region = region;
+	}
+	patch->count = count;
+
+	/* Record maximum ending offsets, and identify the unpatched
+	 * remainder of the original image body
+	 */
+	patch->untouched = 0;
+	for ( i = 0 ; i < count ; i++ ) {
+		region = index[i].region;
+		if ( end < ( region->offset + region->len ) )
+			end = ( region->offset + region->len );
+		index[i].end = end;
+		if ( region->offset < body_len )
+			patch->untouched = end;
+	}
+	DBG ( "...patching WIM %d regions, body unpatched from %#zx\n",
+	      count, patch->untouched );
+}
+
 /**
  * Patch WIM file
  *
@@ -786,6 +1066,9 @@ void patch_wim ( struct vdisk_file *file, void *data, size_t offset,
 	struct wim_patch *patch = &cached_patch;
 	struct wim_patch_region *region;
 	unsigned int boot_index;
+	unsigned int low;
+	unsigned int high;
+	unsigned int mid;
 	unsigned int i;
 	int inject;
 	int rc;
@@ -802,13 +1085,31 @@ void patch_wim ( struct vdisk_file *file, void *data, size_t offset,
 						  patch ) ) != 0 ) {
 			die ( "Could not patch WIM %s\n", file->name );
 		}
+		wim_index_patch ( patch );
+	}
+
+	/* Do nothing if reading only unpatched original image body */
+	if ( ( offset >= patch->untouched ) &&
+	     ( ( offset + len ) <= file->len ) )
+		return;
+
+	/* Find first region that may overlap the read */
+	low = 0;
+	high = patch->count;
+	while ( low < high ) {
+		mid = ( ( low + high ) / 2 );
+		if ( patch->index[mid].end > offset ) {
+			high = mid;
+		} else {
+			low = ( mid + 1 );
+		}
 	}
-	patch = &cached_patch;
 
 	/* Patch regions */
-	for ( i = 0 ; i < ( sizeof ( patch->regions ) /
-			    sizeof ( patch->regions.region[0] ) ) ; i++ ) {
-		region = &patch->regions.region[i];
+	for ( i = low ; i < patch->count ; i++ ) {
+		region = patch->index[i].region;
+		if ( region->offset >= ( offset + len ) )
+			break;
 		if ( ( rc = wim_patch_region ( patch, region, data, offset,
 					       len ) ) != 0 ) {
 			die ( "Could not patch WIM %s %s at [%#zx,%#zx)\n",
@@ -30,42 +30,339 @@
 #include <stdio.h>
 #include "wimboot.h"
 #include "huffman.h"
+#include "lz77.h"
 #include "xca.h"
 
+/** Cached Huffman alphabets */
+static struct xca_alphabet xca_alphabets[XCA_ALPHABETS];
+
+/** Huffman alphabet cache usage counter */
+static unsigned long xca_alphabet_ticks;
+
+/** Number of Huffman alphabets reused from the cache */
+unsigned long xca_alphabet_hits;
+
+/** Number of Huffman alphabets constructed */
+unsigned long xca_alphabet_misses;
+
+/** Symbol lengths used while constructing a Huffman alphabet */
+static uint8_t xca_lengths[XCA_CODES];
+
 /**
- * Decompress XCA-compressed data
+ * Hash Huffman lengths table
+ *
+ * @v lengths		Huffman lengths table
+ * @ret hash		Hash value
+ */
+static uint32_t xca_hash ( const struct xca_huf_len *lengths ) {
+	const uint8_t *data = lengths->nibbles;
+	uint32_t hash = 0;
+	unsigned int i;
+
+	/* Use FNV-1a on 32-bit words (which may be unaligned) */
+	for ( i = 0 ; i < sizeof ( lengths->nibbles ) ; i += 4 ) {
+		hash ^= ( data[i] | ( data[ i + 1 ] << 8 ) |
+			  ( data[ i + 2 ] << 16 ) |
+			  ( ( uint32_t ) data[ i + 3 ] << 24 ) );
+		hash *= 0x01000193;
+	}
+	return hash;
+}
+
+/**
+ * Get Huffman alphabet for a lengths table
+ *
+ * @v lengths		Huffman lengths table
+ * @ret alphabet	Cached Huffman alphabet, or NULL on error
  *
+ * Blocks within an XCA stream (and consecutive chunks within a WIM
+ * resource) frequently reuse an identical lengths table.  A matching
+ * cached alphabet is therefore reused if available; otherwise the
+ * least recently used cache entry is replaced.
+ */
+static struct xca_alphabet *
+xca_alphabet ( const struct xca_huf_len *lengths ) {
+	struct xca_alphabet *alphabet;
+	struct xca_alphabet *victim = xca_alphabets;
+	uint32_t hash;
+	unsigned int raw;
+
+	/* Look for a matching cached alphabet */
+	hash = xca_hash ( lengths );
+	for ( alphabet = xca_alphabets ;
+	      alphabet < &xca_alphabets[XCA_ALPHABETS] ; alphabet++ ) {
+		if ( alphabet->used && ( alphabet->hash == hash ) &&
+		     ( memcmp ( &alphabet->lengths, lengths,
+				sizeof ( alphabet->lengths ) ) == 0 ) ) {
+			alphabet->used = ++xca_alphabet_ticks;
+			xca_alphabet_hits++;
+			return alphabet;
+		}
+		if ( alphabet->used < victim->used )
+			victim = alphabet;
+	}
+	xca_alphabet_misses++;
+
+	/* Construct symbol lengths */
+	victim->used = 0;
+	for ( raw = 0 ; raw < XCA_CODES ; raw++ )
+		xca_lengths[raw] = xca_huf_len ( lengths, raw );
+
+	/* Construct Huffman alphabet */
+	if ( huffman_alphabet ( &victim->alphabet, xca_lengths,
+				XCA_CODES ) != 0 )
+		return NULL;
+	memcpy ( &victim->lengths, lengths, sizeof ( victim->lengths ) );
+	victim->hash = hash;
+	victim->used = ++xca_alphabet_ticks;
+
+	return victim;
+}
+
+/**
+ * Initialise XCA decompressor
+ *
+ * @v xca		Decompressor
  * @v data		Compressed data
  * @v len		Length of compressed data
  * @v buf		Decompression buffer, or NULL
+ * @v max_len		Length of decompression buffer (if present)
+ *
+ * The compressed data and decompression buffer must remain valid
+ * until decompression is complete.
+ */
+void xca_init ( struct xca *xca, const void *data, size_t len, void *buf,
+		size_t max_len ) {
+
+	xca->alphabet = NULL;
+	xca->lengths = NULL;
+	xca->data = data;
+	xca->src = data;
+	xca->end = ( data + len );
+	xca->out = buf;
+	xca->max_len = max_len;
+	xca->out_len = 0;
+	xca->threshold = 0;
+	xca->accum = 0;
+	xca->extra_bits = 0;
+}
+
+/**
+ * Refill XCA fast path bit accumulator
+ *
+ * @v src		Current position within compressed data
+ * @v accum		Bit accumulator
+ * @v bits		Number of bits in accumulator (must be less than 64)
+ * @ret src		New position within compressed data
+ *
+ * Eight bytes of input data must be available.  Whole input words
+ * are added to the accumulator to leave between 48 and 63 bits.  Any
+ * bits below those accounted for are a prefix of the following input
+ * word, and so are unchanged by the next refill.
+ */
+static inline __attribute__ (( always_inline )) const void *
+xca_refill ( const void *src, xca_accumulator_t *accum, unsigned int *bits ) {
+	xca_accumulator_t words;
+	unsigned int fetch;
+
+	/* Fetch four input words, with the first in the highest bits */
+	__builtin_memcpy ( &words, src, sizeof ( words ) );
+	words = ( ( words << 32 ) | ( words >> 32 ) );
+	words = ( ( ( words & 0x0000ffff0000ffffULL ) << 16 ) |
+		  ( ( words >> 16 ) & 0x0000ffff0000ffffULL ) );
+
+	/* Add to accumulator */
+	*accum |= ( words >> *bits );
+	fetch = ( ( XCA_ACCUMULATOR_BITS - 1 - *bits ) & ~15 );
+	src += ( fetch / 8 );
+	*bits += fetch;
+
+	return src;
+}
+
+/**
+ * Return unused words from XCA fast path bit accumulator
+ *
+ * @v src		Current position within compressed data
+ * @v accum		Bit accumulator
+ * @v bits		Number of bits in accumulator
+ * @ret src		New position within compressed data
+ *
+ * Discard any whole input words beyond those that would be held by a
+ * minimal decoder (i.e. one that fetches a single input word only
+ * when fewer than 16 bits remain), returning them to the input
+ * stream.  The accumulator and such a decoder always hold a number of
+ * bits differing by a multiple of 16.  At least one symbol must have
+ * been consumed since the start of the current block.
+ */
+static inline __attribute__ (( always_inline )) const void *
+xca_unfetch ( const void *src, xca_accumulator_t *accum,
+	      unsigned int *bits ) {
+	unsigned int held = ( 16 + ( *bits % 16 ) );
+
+	src -= ( ( *bits - held ) / 8 );
+	*accum &= ~( ( ~( ( xca_accumulator_t ) 0 ) ) >> held );
+	*bits = held;
+
+	return src;
+}
+
+/**
+ * Continue XCA decompression via fast path
+ *
+ * @v xca		Decompressor
+ * @v limit		Length of decompressed data at which to stop
+ * @ret rc		Return status code
+ *
+ * The fast path may be used only when a decompression buffer is
+ * present, and only while at least XCA_FAST_MARGIN bytes of input
+ * remain.  The caller must ensure that the limit lies within both
+ * the current block and the decompression buffer.
+ */
+static int xca_fast ( struct xca *xca, size_t limit ) {
+	struct huffman_alphabet *alphabet = &xca->alphabet->alphabet;
+	const void *src = xca->src;
+	const void *end = xca->end;
+	uint8_t *start = ( xca->out - xca->out_len );
+	uint8_t *out = xca->out;
+	uint8_t *out_limit = ( start + limit );
+	uint8_t *out_end = ( start + xca->max_len );
+	xca_accumulator_t accum;
+	unsigned int bits;
+	huffman_lookup_t entry;
+	unsigned int raw;
+	unsigned int len;
+	unsigned int match_len;
+	unsigned int match_offset_bits;
+	size_t match_offset;
+
+	/* Convert to fast path accumulator */
+	accum = ( ( ( xca_accumulator_t ) xca->accum ) <<
+		  ( XCA_ACCUMULATOR_BITS - 32 ) );
+	bits = ( 16 + xca->extra_bits );
+
+	/* Process data stream */
+	while ( ( out < out_limit ) && ( ( end - src ) >= XCA_FAST_MARGIN ) ) {
+
+		/* Refill accumulator */
+		src = xca_refill ( src, &accum, &bits );
+
+		/* Determine symbol */
+		entry = huffman_decode ( alphabet,
+					 ( accum >> ( XCA_ACCUMULATOR_BITS -
+						      HUFFMAN_BITS ) ) );
+		raw = huffman_raw ( entry );
+		len = huffman_len ( entry );
+		accum <<= len;
+		bits -= len;
+
+		/* Literal symbol - add to output stream */
+		if ( likely ( raw < XCA_END_MARKER ) ) {
+			*(out++) = raw;
+			continue;
+		}
+
+		/* LZ77 match symbol (the end marker cannot occur
+		 * this far from the end of the input data)
+		 */
+		raw -= XCA_END_MARKER;
+		match_offset_bits = ( raw >> 4 );
+		match_len = ( raw & 0x0f );
+		if ( match_len == 0x0f ) {
+
+			/* Read byte-aligned match length */
+			src = xca_unfetch ( src, &accum, &bits );
+			match_len = *( ( const uint8_t * ) src );
+			src++;
+			if ( match_len == 0xff ) {
+				match_len = *( ( const uint16_t * ) src );
+				src += sizeof ( uint16_t );
+			} else {
+				match_len += 0x0f;
+			}
+			src = xca_refill ( src, &accum, &bits );
+		}
+		match_len += 3;
+		match_offset = ( ( ( accum >> 1 ) |
+				   ~( ( ~( ( xca_accumulator_t ) 0 ) ) >> 1 ) )
+				 >> ( XCA_ACCUMULATOR_BITS - 1 -
+				      match_offset_bits ) );
+		accum <<= match_offset_bits;
+		bits -= match_offset_bits;
+
+		/* Copy data */
+		if ( unlikely ( match_offset > ( size_t ) ( out - start ) ) ) {
+			DBG ( "XCA match underrun at output length %#zx\n",
+			      ( out - start ) );
+			return -1;
+		}
+		if ( unlikely ( match_len > ( size_t ) ( out_end - out ) ) ) {
+			DBG ( "XCA output overrun at output length %#zx\n",
+			      ( out - start ) );
+			return -1;
+		}
+		out = lz77_copy ( out, match_offset, match_len );
+	}
+
+	/* Return unused words to the input stream */
+	src = xca_unfetch ( src, &accum, &bits );
+	xca->src = src;
+	xca->out = out;
+	xca->out_len = ( out - start );
+	xca->accum = ( accum >> ( XCA_ACCUMULATOR_BITS - 32 ) );
+	xca->extra_bits = ( bits - 16 );
+
+	return 0;
+}
+
+/**
+ * Continue XCA decompression
+ *
+ * @v xca		Decompressor
+ * @v want		Required length of decompressed data
  * @ret out_len		Length of decompressed data, or negative error
+ *
+ * Decompression is suspended once at least the required length of
+ * output has been produced, and may be resumed by a subsequent call.
+ * The returned length is less than the required length only if the
+ * compressed data ends first.
  */
-ssize_t xca_decompress ( const void *data, size_t len, void *buf ) {
-	const void *src = data;
-	const void *end = ( src + len );
-	uint8_t *out = buf;
-	size_t out_len = 0;
-	size_t out_len_threshold = 0;
-	const struct xca_huf_len *lengths;
-	struct xca xca;
-	uint32_t accum = 0;
-	int extra_bits = 0;
+ssize_t xca_resume ( struct xca *xca, size_t want ) {
+	const void *data = xca->data;
+	const void *src = xca->src;
+	const void *end = xca->end;
+	uint8_t *out = xca->out;
+	size_t max_len = xca->max_len;
+	size_t out_len = xca->out_len;
+	size_t out_len_threshold = xca->threshold;
+	struct xca_alphabet *alphabet = xca->alphabet;
+	const struct xca_huf_len *lengths = xca->lengths;
+	uint32_t accum = xca->accum;
+	int extra_bits = xca->extra_bits;
 	unsigned int huf;
-	struct huffman_symbols *sym;
+	huffman_lookup_t entry;
 	unsigned int raw;
 	unsigned int match_len;
 	unsigned int match_offset_bits;
 	unsigned int match_offset;
-	const uint8_t *copy;
-	int rc;
+	size_t limit;
+
+	/* Reacquire alphabet if evicted from the cache while suspended */
+	if ( alphabet && ( ( ! alphabet->used ) ||
+			   ( memcmp ( &alphabet->lengths, lengths,
+				      sizeof ( alphabet->lengths ) ) != 0 ) ) ) {
+		alphabet = xca_alphabet ( lengths );
+		if ( ! alphabet )
+			return -1;
+	}
 
 	/* Process data stream */
-	while ( src < end ) {
+	while ( ( src < end ) && ( out_len < want ) ) {
 
 		/* (Re)initialise decompressor if applicable */
 		if ( out_len >= out_len_threshold ) {
 
-			/* Construct symbol lengths */
+			/* Get Huffman alphabet */
 			lengths = src;
 			src += sizeof ( *lengths );
 			if ( src > end ) {
@@ -74,33 +371,56 @@ ssize_t xca_decompress ( const void *data, size_t len, void *buf ) {
 				      ( src - data ) );
 				return -1;
 			}
-			for ( raw = 0 ; raw < XCA_CODES ; raw++ )
-				xca.lengths[raw] = xca_huf_len ( lengths, raw );
-
-			/* Construct Huffman alphabet */
-			if ( ( rc = huffman_alphabet ( &xca.alphabet,
-						       xca.lengths,
-						       XCA_CODES ) ) != 0 )
-				return rc;
+			alphabet = xca_alphabet ( lengths );
+			if ( ! alphabet )
+				return -1;
 
 			/* Initialise state */
-			accum = XCA_GET16 ( src );
+			accum = XCA_GET16 ( src, end );
 			accum <<= 16;
-			accum |= XCA_GET16 ( src );
+			accum |= XCA_GET16 ( src, end );
 			extra_bits = 16;
 
 			/* Determine next threshold */
 			out_len_threshold = ( out_len + XCA_BLOCK_SIZE );
 		}
 
+		/* Use fast path while sufficiently far from the end of
+		 * the input data, the output buffer, and the current block
+		 */
+		if ( XCA_FAST && out &&
+		     ( ( end - src ) >= XCA_FAST_MARGIN ) ) {
+			limit = want;
+			if ( limit > out_len_threshold )
+				limit = out_len_threshold;
+			if ( limit > max_len )
+				limit = max_len;
+			if ( out_len < limit ) {
+				xca->alphabet = alphabet;
+				xca->src = src;
+				xca->out = out;
+				xca->out_len = out_len;
+				xca->accum = accum;
+				xca->extra_bits = extra_bits;
+				if ( xca_fast ( xca, limit ) != 0 )
+					return -1;
+				src = xca->src;
+				out = xca->out;
+				out_len = xca->out_len;
+				accum = xca->accum;
+				extra_bits = xca->extra_bits;
+				continue;
+			}
+		}
+
 		/* Determine symbol */
 		huf = ( accum >> ( 32 - HUFFMAN_BITS ) );
-		sym = huffman_sym ( &xca.alphabet, huf );
-		raw = huffman_raw ( sym, huf );
-		accum <<= huffman_len ( sym );
-		extra_bits -= huffman_len ( sym );
+		entry = huffman_decode ( &alphabet->alphabet, huf );
+		raw = huffman_raw ( entry );
+		accum <<= huffman_len ( entry );
+		extra_bits -= huffman_len ( entry );
 		if ( extra_bits < 0 ) {
-			accum |= ( XCA_GET16 ( src ) << ( -extra_bits ) );
+			accum |= ( XCA_GET16 ( src, end ) << ( -extra_bits ) );
 			extra_bits += 16;
 		}
 
@@ -108,15 +428,22 @@ ssize_t xca_decompress ( const void *data, size_t len, void *buf ) {
 		if ( raw < XCA_END_MARKER ) {
 
 			/* Literal symbol - add to output stream */
-			if ( buf )
+			if ( out ) {
+				if ( out_len >= max_len ) {
+					DBG ( "XCA output overrun at output "
+					      "length %#zx\n", out_len );
+					return -1;
+				}
 				*(out++) = raw;
+			}
 			out_len++;
 
 		} else if ( ( raw == XCA_END_MARKER ) &&
 			    ( src >= ( end - 1 ) ) ) {
 
 			/* End marker symbol */
-			return out_len;
+			src = end;
+			break;
 
 		} else {
 
@@ -125,9 +452,9 @@ ssize_t xca_decompress ( const void *data, size_t len, void *buf ) {
 			match_offset_bits = ( raw >> 4 );
 			match_len = ( raw & 0x0f );
 			if ( match_len == 0x0f ) {
-				match_len = XCA_GET8 ( src );
+				match_len = XCA_GET8 ( src, end );
 				if ( match_len == 0xff ) {
-					match_len = XCA_GET16 ( src );
+					match_len = XCA_GET16 ( src, end );
 				} else {
 					match_len += 0x0f;
 				}
@@ -143,24 +470,62 @@ ssize_t xca_decompress ( const void *data, size_t len, void *buf ) {
 			accum <<= match_offset_bits;
 			extra_bits -= match_offset_bits;
 			if ( extra_bits < 0 ) {
-				accum |= ( XCA_GET16 ( src ) << (-extra_bits) );
+				accum |= ( XCA_GET16 ( src, end ) <<
+					   ( -extra_bits ) );
 				extra_bits += 16;
 			}
 
 			/* Copy data */
-			out_len += match_len;
-			if ( buf ) {
-				copy = ( out - match_offset );
-				while ( match_len-- )
-					*(out++) = *(copy++);
+			if ( match_offset > out_len ) {
+				DBG ( "XCA match underrun at output length "
+				      "%#zx\n", out_len );
+				return -1;
 			}
+			if ( out && ( match_len > ( max_len - out_len ) ) ) {
+				DBG ( "XCA output overrun at output length "
+				      "%#zx\n", out_len );
+				return -1;
+			}
+			out_len += match_len;
+			if ( out )
+				out = lz77_copy ( out, match_offset, match_len );
 		}
 	}
 
-	/* Allow for termination with no explicit end marker symbol */
-	if ( src == end )
+	/* Record state for resumption */
+	xca->alphabet = alphabet;
+	xca->lengths = lengths;
+	xca->src = src;
+	xca->out = out;
+	xca->out_len = out_len;
+	xca->threshold = out_len_threshold;
+	xca->accum = accum;
+	xca->extra_bits = extra_bits;
+
+	/* Allow for suspension, or termination with no explicit end
+	 * marker symbol.
+	 */
+	if ( src <= end )
 		return out_len;
 
 	DBG ( "XCA input overrun at output length %#zx\n", out_len );
 	return -1;
 }
+
+/**
+ * Decompress XCA-compressed data
+ *
+ * @v data		Compressed data
+ * @v len		Length of compressed data
+ * @v buf		Decompression buffer, or NULL
+ * @v max_len		Length of decompression buffer (if present)
+ * @ret out_len		Length of decompressed data, or negative error
+ */
+ssize_t xca_decompress ( const void *data, size_t len, void *buf,
+			 size_t max_len ) {
+	struct xca xca;
+
+	/* Decompress all data */
+	xca_init ( &xca, data, len, buf, max_len );
+	return xca_resume ( &xca, ( ( size_t ) -1 ) );
+}
@@ -33,8 +33,17 @@
 /** Number of XCA codes */
 #define XCA_CODES 512
 
-/** XCA decompressor */
-struct xca {
+/** XCA symbol Huffman lengths table */
+struct xca_huf_len {
+	/** Lengths of each symbol */
+	uint8_t nibbles[ XCA_CODES / 2 ];
+} __attribute__ (( packed ));
+
+/** Number of cached XCA Huffman alphabets */
+#define XCA_ALPHABETS 4
+
+/** A cached XCA Huffman alphabet */
+struct xca_alphabet {
 	/** Huffman alphabet */
 	struct huffman_alphabet alphabet;
 	/** Raw symbols
@@ -42,15 +51,39 @@ struct xca {
 	 * Must immediately follow the Huffman alphabet.
 	 */
 	huffman_raw_symbol_t raw[XCA_CODES];
-	/** Code lengths */
-	uint8_t lengths[XCA_CODES];
+	/** Huffman lengths table from which alphabet was constructed */
+	struct xca_huf_len lengths;
+	/** Hash of Huffman lengths table */
+	uint32_t hash;
+	/** Time of last use, or zero if not yet constructed */
+	unsigned long used;
 };
 
-/** XCA symbol Huffman lengths table */
-struct xca_huf_len {
-	/** Lengths of each symbol */
-	uint8_t nibbles[ XCA_CODES / 2 ];
-} __attribute__ (( packed ));
+/** XCA decompressor */
+struct xca {
+	/** Huffman alphabet for current block */
+	struct xca_alphabet *alphabet;
+	/** Huffman lengths table for current block */
+	const struct xca_huf_len *lengths;
+	/** Start of compressed data */
+	const void *data;
+	/** Current position within compressed data */
+	const void *src;
+	/** End of compressed data */
+	const void *end;
+	/** Current position within decompression buffer, or NULL */
+	uint8_t *out;
+	/** Length of decompression buffer (if present) */
+	size_t max_len;
+	/** Length of decompressed data */
+	size_t out_len;
+	/** Length of decompressed data at end of current block */
+	size_t threshold;
+	/** Bit accumulator */
+	uint32_t accum;
+	/** Number of bits available beyond the current 16-bit word */
+	int extra_bits;
+};
 
 /**
  * Extract Huffman-coded length of a raw symbol
@@ -65,17 +98,23 @@ static inline unsigned int xca_huf_len ( const struct xca_huf_len *lengths,
 		   ( 4 * ( symbol % 2 ) ) ) & 0x0f );
 }
 
-/** Get word from source data stream */
-#define XCA_GET16( src ) ( {			\
-	const uint16_t *src16 = src;		\
-	src += sizeof ( *src16 );		\
-	*src16; } )
+/** Get word from source data stream
+ *
+ * Data beyond the end of the stream reads as zero.
+ */
+#define XCA_GET16( src, end ) ( {					\
+	const uint16_t *src16 = src;					\
+	src += sizeof ( *src16 );					\
+	( ( src <= end ) ? *src16 : 0 ); } )
 
-/** Get byte from source data stream */
-#define XCA_GET8( src ) ( {			\
-	const uint8_t *src8 = src;		\
-	src += sizeof ( *src8 );		\
-	*src8; } )
+/** Get byte from source data stream
+ *
+ * Data beyond the end of the stream reads as zero.
+ */
+#define XCA_GET8( src, end ) ( {					\
+	const uint8_t *src8 = src;					\
+	src += sizeof ( *src8 );					\
+	( ( src <= end ) ? *src8 : 0 ); } )
 
 /** XCA source data stream end marker */
 #define XCA_END_MARKER 256
@@ -83,6 +122,35 @@ static inline unsigned int xca_huf_len ( const struct xca_huf_len *lengths,
 /** XCA block size */
 #define XCA_BLOCK_SIZE ( 64 * 1024 )
 
-extern ssize_t xca_decompress ( const void *data, size_t len, void *buf );
+/** XCA fast path bit accumulator */
+typedef uint64_t xca_accumulator_t;
+
+/** Length of XCA fast path bit accumulator (in bits) */
+#define XCA_ACCUMULATOR_BITS ( 8 * sizeof ( xca_accumulator_t ) )
+
+/** Use XCA fast path
+ *
+ * The fast path fetches input words ahead of the position at which
+ * the bitstream format requires them, and needs a 64-bit accumulator
+ * in order to do so.  It is therefore used only where this is the
+ * native word size.
+ */
+#define XCA_FAST ( sizeof ( unsigned long ) >= sizeof ( xca_accumulator_t ) )
+
+/** Minimum remaining input for XCA fast path
+ *
+ * This allows for two accumulator refills and a match length to be
+ * read without checking for the end of the input data.
+ */
+#define XCA_FAST_MARGIN 16
+
+extern unsigned long xca_alphabet_hits;
+extern unsigned long xca_alphabet_misses;
+
+extern void xca_init ( struct xca *xca, const void *data, size_t len,
+		       void *buf, size_t max_len );
+extern ssize_t xca_resume ( struct xca *xca, size_t want );
+extern ssize_t xca_decompress ( const void *data, size_t len, void *buf,
+				size_t max_len );
 
 #endif /* _XCA_H */